@@ -0,0 +1,423 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#include "Character.h"
+#include "WorkerPool.h"
+#include "WorldGrid.h"
+
+//Which kind of grid line a ray crossed when it stopped. Matches hitDetails alignment: vertical walls are hit crossing an X grid line.
+enum WallFace : std::uint8_t
+{
+    FACE_VERTICAL,
+    FACE_HORIZONTAL,
+    FACE_NONE
+};
+
+/*
+Cameras to cast rays for, one entry per agent in each array. Positions are in world pixels, angles in radians.
+Agent a casts rayCount[a] rays spread over its field of view using the same flat camera plane projection as Character,
+or the projectionMode given in projection[a]. Panoramic agents ignore their field of view. projection may be null for all flat.
+*/
+struct RayBatchInput
+{
+    const float* positionX;
+    const float* positionY;
+    const float* heading;
+    const float* fieldOfView;
+    const int* rayCount;
+    int agentCount;
+    const std::uint8_t* projection{ nullptr };
+};
+
+/*
+Caller owned result buffers, each holding countRays() entries. The rays of agent a are stored contiguously
+after the rays of agents 0 to a - 1. Rays leaving the grid or running out of steps report material 0.
+*/
+struct RayBatchOutput
+{
+    float* distance;
+    int* material;
+    std::uint8_t* face;
+};
+
+/*
+Individual rays to cast, count entries in each array. Origins are in world pixels, directions must have unit length.
+*/
+struct RayBatchRays
+{
+    const float* originX;
+    const float* originY;
+    const float* dirX;
+    const float* dirY;
+    int count;
+};
+
+/*
+Casts rays for many agents at once against a WorldGrid.
+
+All rays of a batch are flattened into one range that is split into chunks across the worker pool, so a few agents with
+many rays and many agents with few rays balance the same way. Inside a chunk rays are traversed 8 at a time with AVX2,
+one ray per lane, with a scalar loop for the remainder and for builds without AVX2.
+Rays stop at the first wall of any material, transparent ones included, since a ray reports a single hit.
+*/
+class BatchRaycaster
+{
+
+private:
+
+    static constexpr int RAYS_PER_CHUNK = 64;
+
+    const WorldGrid& grid;
+    //a ray crosses at most width + height cells before reaching the sentinel border
+    int maxSteps;
+    //index of the first ray of each agent, plus the total at the end
+    std::vector<int> rayOffsets;
+
+    //Ray angles of the angular projections relative to the heading, one table per ray count, field of view and projection.
+    //Kept between batches, agents usually share a few camera setups.
+    static constexpr int MAX_ANGLE_TABLES = 64;
+    struct angleTable
+    {
+        int rayCount;
+        float fieldOfView;
+        std::uint8_t projection;
+        std::vector<float> offsetCos;
+        std::vector<float> offsetSin;
+    };
+    std::vector<angleTable> angleTables;
+    //table used by each agent of the current batch, -1 for the flat projection
+    std::vector<int> agentTables;
+
+    /*
+    Find or build the angle table for a camera setup.
+    */
+    int findAngleTable(int rayCount, float fieldOfView, std::uint8_t projection)
+    {
+        if (projection == PROJECTION_PANORAMIC)
+        {
+            fieldOfView = float(2 * PI);
+        }
+        for (int t = 0; t < int(angleTables.size()); ++t)
+        {
+            const angleTable& table = angleTables[t];
+            if (table.rayCount == rayCount && table.fieldOfView == fieldOfView && table.projection == projection)
+            {
+                return t;
+            }
+        }
+
+        //same column order as the flat projection: ray 0 is on the side the camera plane points away from
+        angleTable table;
+        table.rayCount = rayCount;
+        table.fieldOfView = fieldOfView;
+        table.projection = projection;
+        table.offsetCos.resize(rayCount);
+        table.offsetSin.resize(rayCount);
+        for (int column = 0; column < rayCount; ++column)
+        {
+            double angle = -(2.0 * (column + 0.5) / rayCount - 1.0) * fieldOfView * 0.5;
+            table.offsetCos[column] = float(std::cos(angle));
+            table.offsetSin[column] = float(std::sin(angle));
+        }
+        angleTables.push_back(std::move(table));
+        return int(angleTables.size()) - 1;
+    }
+
+    /*
+    Cast one ray through the grid with DDA. Origin and direction are in cell units, direction has unit length.
+    Rays stop on the grid's sentinel border, so the stepping loop has no bounds checks.
+    */
+    void castScalar(float originX, float originY, float dirX, float dirY, float& distance, int& material, std::uint8_t& face) const
+    {
+        int mapX = int(std::floor(originX));
+        int mapY = int(std::floor(originY));
+        if (!grid.contains(mapX, mapY))
+        {
+            distance = 0.f;
+            material = 0;
+            face = FACE_NONE;
+            return;
+        }
+
+        const int* cells = grid.paddedData();
+        int index = grid.paddedIndex(mapX, mapY);
+        float deltaX = (dirX == 0.f) ? 1e30f : std::abs(1.f / dirX);
+        float deltaY = (dirY == 0.f) ? 1e30f : std::abs(1.f / dirY);
+        int stepX = dirX < 0.f ? -1 : 1;
+        int stepY = dirY < 0.f ? -1 : 1;
+        int stepIndexY = stepY * grid.getStride();
+        float sideX = dirX < 0.f ? (originX - mapX) * deltaX : (mapX + 1.f - originX) * deltaX;
+        float sideY = dirY < 0.f ? (originY - mapY) * deltaY : (mapY + 1.f - originY) * deltaY;
+
+        float travelled = 0.f;
+        int hitMaterial = 0;
+        std::uint8_t hitFace = FACE_NONE;
+        for (int step = 0; step < maxSteps; ++step)
+        {
+            if (sideX < sideY)
+            {
+                travelled = sideX;
+                sideX += deltaX;
+                index += stepX;
+                hitFace = FACE_VERTICAL;
+            }
+            else
+            {
+                travelled = sideY;
+                sideY += deltaY;
+                index += stepIndexY;
+                hitFace = FACE_HORIZONTAL;
+            }
+            hitMaterial = cells[index];
+            if (hitMaterial != 0)
+            {
+                break;
+            }
+        }
+        distance = travelled * float(BLOCK_WIDTH);
+        material = hitMaterial > 0 ? hitMaterial : 0;
+        face = hitFace;
+    }
+
+#if defined(__AVX2__)
+    /*
+    Cast 8 rays in lockstep, one per lane. Same arithmetic as castScalar so both give identical results.
+    Lanes that stop are masked off while the others keep stepping.
+    */
+    void castPacket(const float* originX, const float* originY, const float* dirX, const float* dirY, float* distance, int* material, std::uint8_t* face) const
+    {
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 one = _mm256_set1_ps(1.f);
+        const __m256 far = _mm256_set1_ps(1e30f);
+        const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+        const __m256i width = _mm256_set1_epi32(grid.getWidth());
+        const __m256i height = _mm256_set1_epi32(grid.getHeight());
+        const __m256i stride = _mm256_set1_epi32(grid.getStride());
+        const __m256i minusOne = _mm256_set1_epi32(-1);
+
+        __m256 posX = _mm256_loadu_ps(originX);
+        __m256 posY = _mm256_loadu_ps(originY);
+        __m256 rayX = _mm256_loadu_ps(dirX);
+        __m256 rayY = _mm256_loadu_ps(dirY);
+
+        __m256 cellX = _mm256_floor_ps(posX);
+        __m256 cellY = _mm256_floor_ps(posY);
+        __m256i mapX = _mm256_cvttps_epi32(cellX);
+        __m256i mapY = _mm256_cvttps_epi32(cellY);
+
+        __m256 deltaX = _mm256_blendv_ps(_mm256_and_ps(_mm256_div_ps(one, rayX), absMask), far, _mm256_cmp_ps(rayX, zero, _CMP_EQ_OQ));
+        __m256 deltaY = _mm256_blendv_ps(_mm256_and_ps(_mm256_div_ps(one, rayY), absMask), far, _mm256_cmp_ps(rayY, zero, _CMP_EQ_OQ));
+        __m256 negativeX = _mm256_cmp_ps(rayX, zero, _CMP_LT_OQ);
+        __m256 negativeY = _mm256_cmp_ps(rayY, zero, _CMP_LT_OQ);
+        __m256i stepX = _mm256_blendv_epi8(_mm256_set1_epi32(1), minusOne, _mm256_castps_si256(negativeX));
+        __m256i stepY = _mm256_blendv_epi8(_mm256_set1_epi32(1), minusOne, _mm256_castps_si256(negativeY));
+        __m256i stepIndexY = _mm256_mullo_epi32(stepY, stride);
+        __m256 sideX = _mm256_mul_ps(_mm256_blendv_ps(_mm256_sub_ps(_mm256_add_ps(cellX, one), posX), _mm256_sub_ps(posX, cellX), negativeX), deltaX);
+        __m256 sideY = _mm256_mul_ps(_mm256_blendv_ps(_mm256_sub_ps(_mm256_add_ps(cellY, one), posY), _mm256_sub_ps(posY, cellY), negativeY), deltaY);
+
+        __m256 travelled = zero;
+        __m256i hitMaterial = _mm256_setzero_si256();
+        __m256i hitFace = _mm256_set1_epi32(FACE_NONE);
+
+        //lanes starting outside the grid report nothing and never step, the rest stop on the sentinel border at the latest
+        __m256i active = _mm256_and_si256(
+            _mm256_and_si256(_mm256_cmpgt_epi32(mapX, minusOne), _mm256_cmpgt_epi32(width, mapX)),
+            _mm256_and_si256(_mm256_cmpgt_epi32(mapY, minusOne), _mm256_cmpgt_epi32(height, mapY)));
+        __m256i index = _mm256_and_si256(active, _mm256_add_epi32(_mm256_mullo_epi32(_mm256_add_epi32(mapY, _mm256_set1_epi32(1)), stride), _mm256_add_epi32(mapX, _mm256_set1_epi32(1))));
+
+        for (int step = 0; step < maxSteps && !_mm256_testz_si256(active, active); ++step)
+        {
+            __m256 activeLanes = _mm256_castsi256_ps(active);
+            __m256 takeX = _mm256_cmp_ps(sideX, sideY, _CMP_LT_OQ);
+            __m256 moveX = _mm256_and_ps(takeX, activeLanes);
+            __m256 moveY = _mm256_andnot_ps(takeX, activeLanes);
+
+            travelled = _mm256_blendv_ps(travelled, _mm256_blendv_ps(sideY, sideX, takeX), activeLanes);
+            sideX = _mm256_add_ps(sideX, _mm256_and_ps(deltaX, moveX));
+            sideY = _mm256_add_ps(sideY, _mm256_and_ps(deltaY, moveY));
+            index = _mm256_add_epi32(index, _mm256_and_si256(stepX, _mm256_castps_si256(moveX)));
+            index = _mm256_add_epi32(index, _mm256_and_si256(stepIndexY, _mm256_castps_si256(moveY)));
+            __m256i laneFace = _mm256_blendv_epi8(_mm256_set1_epi32(FACE_HORIZONTAL), _mm256_set1_epi32(FACE_VERTICAL), _mm256_castps_si256(takeX));
+            hitFace = _mm256_blendv_epi8(hitFace, laneFace, active);
+
+            __m256i cell = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), grid.paddedData(), index, active, 4);
+            hitMaterial = _mm256_blendv_epi8(hitMaterial, cell, active);
+            active = _mm256_and_si256(active, _mm256_cmpeq_epi32(cell, _mm256_setzero_si256()));
+        }
+        hitMaterial = _mm256_max_epi32(hitMaterial, _mm256_setzero_si256());
+
+        _mm256_storeu_ps(distance, _mm256_mul_ps(travelled, _mm256_set1_ps(float(BLOCK_WIDTH))));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(material), hitMaterial);
+        alignas(32) int faces[8];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(faces), hitFace);
+        for (int lane = 0; lane < 8; ++lane)
+        {
+            face[lane] = std::uint8_t(faces[lane]);
+        }
+    }
+#endif
+
+public:
+
+    /*
+    Params:
+        grid - map to cast against. Must outlive the raycaster.
+    */
+    explicit BatchRaycaster(const WorldGrid& grid) :
+        grid(grid), maxSteps(grid.getWidth() + grid.getHeight() + 2)
+    {
+    }
+
+    /*
+    Cast a run of rays whose origins and unit directions are given in cell units, on the calling thread.
+    For callers that split their own work across threads, like VectorEnvironment. Distances are in world pixels.
+    */
+    void castRays(const float* originX, const float* originY, const float* dirX, const float* dirY, int count, float* distance, int* material, std::uint8_t* face) const
+    {
+        int i = 0;
+#if defined(__AVX2__)
+        for (; i + 8 <= count; i += 8)
+        {
+            castPacket(originX + i, originY + i, dirX + i, dirY + i, distance + i, material + i, face + i);
+        }
+#endif
+        for (; i < count; ++i)
+        {
+            castScalar(originX[i], originY[i], dirX[i], dirY[i], distance[i], material[i], face[i]);
+        }
+    }
+
+    /*
+    Get the number of entries the output buffers need for a batch.
+
+    Params:
+        rayCount - rays cast by each agent.
+        agentCount - number of agents.
+    */
+    static int countRays(const int* rayCount, int agentCount)
+    {
+        int total = 0;
+        for (int a = 0; a < agentCount; ++a)
+        {
+            total += rayCount[a];
+        }
+        return total;
+    }
+
+    /*
+    Cast every ray of every agent and write the results into the output buffers.
+
+    Params:
+        input - agent positions, headings, fields of view and ray counts.
+        output - buffers with room for countRays() results.
+        pool - workers the rays are split across.
+    */
+    void cast(const RayBatchInput& input, const RayBatchOutput& output, WorkerPool& pool)
+    {
+        rayOffsets.resize(size_t(input.agentCount) + 1);
+        rayOffsets[0] = 0;
+        for (int a = 0; a < input.agentCount; ++a)
+        {
+            rayOffsets[a + 1] = rayOffsets[a] + input.rayCount[a];
+        }
+        int totalRays = rayOffsets.back();
+
+        agentTables.assign(input.agentCount, -1);
+        if (input.projection)
+        {
+            if (angleTables.size() > MAX_ANGLE_TABLES)
+            {
+                angleTables.clear();
+            }
+            for (int a = 0; a < input.agentCount; ++a)
+            {
+                if (input.projection[a] != PROJECTION_FLAT)
+                {
+                    agentTables[a] = findAngleTable(input.rayCount[a], input.fieldOfView[a], input.projection[a]);
+                }
+            }
+        }
+
+        pool.parallelFor(totalRays, RAYS_PER_CHUNK, [&](int begin, int end)
+        {
+            float originX[RAYS_PER_CHUNK];
+            float originY[RAYS_PER_CHUNK];
+            float dirX[RAYS_PER_CHUNK];
+            float dirY[RAYS_PER_CHUNK];
+
+            //agent owning the first ray of the chunk, skipping agents without rays
+            int agent = int(std::upper_bound(rayOffsets.begin(), rayOffsets.end(), begin) - rayOffsets.begin()) - 1;
+            int agentEnd = -1;
+            float headingX = 0.f, headingY = 0.f, planeX = 0.f, planeY = 0.f;
+
+            for (int ray = begin; ray < end; ++ray)
+            {
+                while (ray >= rayOffsets[agent + 1])
+                {
+                    ++agent;
+                }
+                if (agentEnd != rayOffsets[agent + 1])
+                {
+                    //camera plane is perpendicular to the heading like in Character, its half length sets the field of view
+                    agentEnd = rayOffsets[agent + 1];
+                    headingX = std::cos(input.heading[agent]);
+                    headingY = std::sin(input.heading[agent]);
+                    float planeLength = std::tan(input.fieldOfView[agent] * 0.5f);
+                    planeX = headingY * planeLength;
+                    planeY = -headingX * planeLength;
+                }
+
+                int column = ray - rayOffsets[agent];
+                int lane = ray - begin;
+                originX[lane] = input.positionX[agent] / float(BLOCK_WIDTH);
+                originY[lane] = input.positionY[agent] / float(BLOCK_WIDTH);
+                if (agentTables[agent] >= 0)
+                {
+                    //angular projections rotate the precomputed offset by the heading
+                    const angleTable& table = angleTables[agentTables[agent]];
+                    dirX[lane] = headingX * table.offsetCos[column] - headingY * table.offsetSin[column];
+                    dirY[lane] = headingY * table.offsetCos[column] + headingX * table.offsetSin[column];
+                    continue;
+                }
+
+                float cameraX = 2.f * (column + 0.5f) / input.rayCount[agent] - 1.f;
+                float rayX = headingX + planeX * cameraX;
+                float rayY = headingY + planeY * cameraX;
+                float inverseLength = 1.f / std::sqrt(rayX * rayX + rayY * rayY);
+                dirX[lane] = rayX * inverseLength;
+                dirY[lane] = rayY * inverseLength;
+            }
+
+            castRays(originX, originY, dirX, dirY, end - begin, output.distance + begin, output.material + begin, output.face + begin);
+        });
+    }
+
+    /*
+    Cast a list of individual rays, e.g. secondary rays, with the same kernels and chunking as agent batches.
+
+    Params:
+        rays - ray origins and unit directions.
+        output - buffers with room for rays.count results. Distances are in world pixels.
+        pool - workers the rays are split across.
+    */
+    void cast(const RayBatchRays& rays, const RayBatchOutput& output, WorkerPool& pool)
+    {
+        pool.parallelFor(rays.count, RAYS_PER_CHUNK, [&](int begin, int end)
+        {
+            float originX[RAYS_PER_CHUNK];
+            float originY[RAYS_PER_CHUNK];
+            for (int ray = begin; ray < end; ++ray)
+            {
+                originX[ray - begin] = rays.originX[ray] / float(BLOCK_WIDTH);
+                originY[ray - begin] = rays.originY[ray] / float(BLOCK_WIDTH);
+            }
+            castRays(originX, originY, rays.dirX + begin, rays.dirY + begin, end - begin, output.distance + begin, output.material + begin, output.face + begin);
+        });
+    }
+};
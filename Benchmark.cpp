@@ -0,0 +1,74 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <SFML/Graphics/Color.hpp>
+#include "BatchRaycaster.h"
+#include "Character.h"
+#include "KernelBenchmark.h"
+#include "MapGenerator.h"
+#include "WorkerPool.h"
+#include "WorldGrid.h"
+
+/*
+Times the ray kernels on seeded levels of every style, see KernelBenchmark. Build it as its own executable, apart from the demo.
+
+Usage: benchmark [columns] [map size] [seed]
+    columns - pixel columns cast per frame, 1280 by default.
+    map size - cells per side of the square levels, 256 by default.
+    seed - level seed, 1 by default.
+
+Build: g++ -std=c++17 -O2 -pthread Benchmark.cpp -o benchmark -lsfml-graphics -lsfml-window -lsfml-system
+Add -mavx2 to time the AVX2 kernels.
+*/
+int main(int argc, char** argv)
+{
+    int columns = argc > 1 ? std::max(std::atoi(argv[1]), 1) : 1280;
+    int mapSize = argc > 2 ? std::max(std::atoi(argv[2]), 3) : 256;
+    std::uint64_t seed = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 1;
+
+    static const char* const STYLE_NAMES[] = { "maze", "cave", "rooms", "open" };
+    WorkerPool pool;
+    MapGenerator generator(pool);
+    GeneratedMap map;
+    KernelBenchmark benchmark;
+    for (int style = MAP_MAZE; style <= MAP_OPEN; ++style)
+    {
+        generator.generate(mapStyle(style), mapSize, mapSize, seed, map);
+        WorldGrid grid(map.width, map.height, map.cells);
+        BatchRaycaster raycaster(grid);
+
+        //stand in the most open cell, nearest the middle of the level on ties, with the demo's camera
+        int bestX = -1;
+        int bestY = -1;
+        int bestClearance = 0;
+        long long bestDistance = 0;
+        for (int y = 0; y < map.height; ++y)
+        {
+            for (int x = 0; x < map.width; ++x)
+            {
+                int clearance = grid.getClearance(x, y);
+                long long distance = (long long)(x - map.width / 2) * (x - map.width / 2) + (long long)(y - map.height / 2) * (y - map.height / 2);
+                if (clearance > bestClearance || (clearance == bestClearance && clearance > 0 && distance < bestDistance))
+                {
+                    bestX = x;
+                    bestY = y;
+                    bestClearance = clearance;
+                    bestDistance = distance;
+                }
+            }
+        }
+        if (bestClearance == 0)
+        {
+            std::printf("\n%s level %d has no empty cell, skipped\n", STYLE_NAMES[style], mapSize);
+            continue;
+        }
+        Character character(16.f, -16, 0, 0, 16, sf::Color(100, 250, 50));
+        character.teleport(float((bestX + 0.5) * BLOCK_WIDTH), float((bestY + 0.5) * BLOCK_WIDTH));
+
+        std::printf("\n%s level, %d x %d cells, seed %llu, camera in cell (%d, %d)", STYLE_NAMES[style], mapSize, mapSize,
+            static_cast<unsigned long long>(seed), bestX, bestY);
+        benchmark.run(character, grid, raycaster, columns);
+    }
+    return 0;
+}
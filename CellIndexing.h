@@ -0,0 +1,77 @@
+#pragma once
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+//Number of bits to shift by to divide by a power of two
+constexpr int powerOfTwoShift(int size)
+{
+    return size > 1 ? 1 + powerOfTwoShift(size / 2) : 0;
+}
+
+/*
+Splits non-negative world pixel coordinates into a cell and a pixel within the cell, for a cell size known at compile time.
+Power of two sizes compile to shifts and masks. Other sizes divide, and the AVX2 versions multiply by the reciprocal instead,
+rounding from the middle of the pixel so the result is exact for coordinates below 2^20.
+*/
+template <int Size>
+struct CellIndexing
+{
+    static_assert(Size > 0, "cells must be at least one pixel wide");
+
+    static constexpr bool POWER_OF_TWO = (Size & (Size - 1)) == 0;
+    static constexpr int SHIFT = POWER_OF_TWO ? powerOfTwoShift(Size) : 0;
+    static constexpr int AREA = Size * Size;
+
+    static int cell(int pixel)
+    {
+        return POWER_OF_TWO ? pixel >> SHIFT : pixel / Size;
+    }
+
+    static int offset(int pixel)
+    {
+        return POWER_OF_TWO ? pixel & (Size - 1) : pixel % Size;
+    }
+
+#if defined(__AVX2__)
+    static __m256i cell(__m256i pixel)
+    {
+        if (POWER_OF_TWO)
+        {
+            return _mm256_srai_epi32(pixel, SHIFT);
+        }
+        __m256 middle = _mm256_add_ps(_mm256_cvtepi32_ps(pixel), _mm256_set1_ps(0.5f));
+        return _mm256_cvttps_epi32(_mm256_mul_ps(middle, _mm256_set1_ps(1.f / Size)));
+    }
+
+    static __m256i offset(__m256i pixel, __m256i cell)
+    {
+        if (POWER_OF_TWO)
+        {
+            return _mm256_and_si256(pixel, _mm256_set1_epi32(Size - 1));
+        }
+        return _mm256_sub_epi32(pixel, _mm256_mullo_epi32(cell, _mm256_set1_epi32(Size)));
+    }
+
+    //index of a texel in a row major texture
+    static __m256i texel(__m256i offsetX, __m256i offsetY)
+    {
+        if (POWER_OF_TWO)
+        {
+            return _mm256_or_si256(_mm256_slli_epi32(offsetY, SHIFT), offsetX);
+        }
+        return _mm256_add_epi32(_mm256_mullo_epi32(offsetY, _mm256_set1_epi32(Size)), offsetX);
+    }
+
+    //index of the first texel of a texture in textures stored one after another
+    static __m256i texture(__m256i index)
+    {
+        if (POWER_OF_TWO)
+        {
+            return _mm256_slli_epi32(index, 2 * SHIFT);
+        }
+        return _mm256_mullo_epi32(index, _mm256_set1_epi32(AREA));
+    }
+#endif
+};
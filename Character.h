@@ -1,14 +1,32 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+#include <SFML/Graphics/CircleShape.hpp>
+#include <SFML/Graphics/Color.hpp>
+#include <SFML/Graphics/Vertex.hpp>
 #include <SFML/OpenGL.hpp>
+#include <SFML/System/Vector2.hpp>
+#include "CellIndexing.h"
+#include "TraceProfiler.h"
+#include "WorldGrid.h"
 
 static constexpr int WORLD_PIXEL_WIDTH = 1024;
 static constexpr int WORLD_PIXEL_HEIGHT = 512;
 static constexpr float MOVEMENT_SPEED{ 2.0f };
 static constexpr double BLOCK_WIDTH{ 32.0f };
+//BLOCK_WIDTH as a whole number of world pixels, for kernels specialized on the block size
+static constexpr int BLOCK_PIXELS = int(BLOCK_WIDTH);
+static_assert(BLOCK_PIXELS == BLOCK_WIDTH, "blocks must be a whole number of world pixels wide");
 static constexpr int WORLD_BLOCK_WIDTH = 1024 / BLOCK_WIDTH;
 static constexpr const int WORLD_BLOCK_HEIGHT = 512 / BLOCK_WIDTH;
+static constexpr double PI{ 3.14159265358979323846 };
+//most transparent walls recorded per column, further ones are skipped
+static constexpr int MAX_TRANSPARENT_LAYERS = 4;
 
 enum movementDirection
 {
@@ -18,13 +36,59 @@ enum movementDirection
     RIGHT
 };
 
+//How calcRays finds the wall hit by each pixel column. Both give identical hits.
+enum rayEngine
+{
+    //cast a ray per column, see Character::calcRays
+    COLUMN_CASTING,
+    //project visible wall faces onto spans of columns, see Character::calcFaceSpans
+    FACE_SPANS
+};
+
+//How screen columns map to ray directions, see Character::calcRayDirection
+enum projectionMode
+{
+    //rays through evenly spaced points of the camera plane, like a pinhole camera
+    PROJECTION_FLAT,
+    //rays at evenly spaced angles over the same field of view as the camera plane
+    PROJECTION_CYLINDRICAL,
+    //rays at evenly spaced angles all the way around the character, the heading in the middle column
+    PROJECTION_PANORAMIC
+};
+
+/*
+Everything that defines a Character between frames, as plain data so saving and restoring it is a memcpy.
+Per frame results such as hits are not included, they are rebuilt by the next calcRays. See Character::saveState.
+*/
+struct CharacterState
+{
+    //top left of the drawn circle and the center rays are cast from, in world pixels
+    float positionX;
+    float positionY;
+    float centerX;
+    float centerY;
+    double dirX;
+    double dirY;
+    double cameraPlaneX;
+    double cameraPlaneY;
+    //end points of the direction ray and camera plane drawn in the 2D view
+    float directionRay[4];
+    float cameraPlane[4];
+    double maxRayDistance;
+    int maxRaySteps;
+    int adaptiveStride;
+    std::uint8_t engine;
+    std::uint8_t projection;
+};
+static_assert(std::is_trivially_copyable<CharacterState>::value, "CharacterState must stay plain data");
+
 class Character
 {
 
 private:
 
-    //Contains details about a ray hitting a wall. Includes distance ray travelled, 
-    //wall color, and whether the wall is horizontal. 
+    //Contains details about a ray hitting a wall. Includes distance to the wall measured perpendicular to the camera plane, 
+    //wall color, and whether the wall is horizontal. A color of 0 means the ray hit nothing within the maximum ray distance. 
     struct hitDetails
     {
         enum Alignment
@@ -35,8 +99,15 @@ private:
         };
 
         double distance{ 0.0 };
+        //1 / distance, used to project the wall height
+        double inverseDistance{ 0.0 };
         int color{ 0 };
         Alignment alignment{ unknown };
+        //map cell of the wall that was hit
+        int cellX{ 0 };
+        int cellY{ 0 };
+        //number of transparent walls in front of this one, stored in Character::getLayers
+        int layerCount{ 0 };
     };
 
 
@@ -70,9 +141,55 @@ private:
     //vector of structs describing results of casting rays. 
     std::vector<hitDetails> hits;
 
+    //transparent walls each column's ray passed through, nearest first. Sized with the hits and reused every frame.
+    std::vector<std::array<hitDetails, MAX_TRANSPARENT_LAYERS>> layers;
+
     //vector of raycast sfml objects used to display where rays are cast in scene. 
     std::vector<sf::Vertex> rayCasts;
 
+    //calcRays casts every adaptiveStride-th column and fills in the rest, see calcRays. 
+    int adaptiveStride{ 8 };
+    //number of columns actually cast by the last calcRays call
+    int castCount{ 0 };
+
+    //length of the direction vector and its reciprocal, updated once per calcRays call
+    double dirLength{ 1.0 };
+    double inverseDirLength{ 1.0 };
+
+    //rays stop without a hit after travelling this far from the camera plane or stepping through this many cells
+    double maxRayDistance{ 2048.0 };
+    int maxRaySteps{ 256 };
+
+    rayEngine engine{ COLUMN_CASTING };
+    projectionMode projection{ PROJECTION_FLAT };
+
+    //Ray direction tables for the angular projections. The angle of each column relative to the heading depends only on the
+    //resolution and field of view, and is rotated into world directions once per heading instead of once per column.
+    struct rayTable
+    {
+        int columns{ -1 };
+        projectionMode projection{ PROJECTION_FLAT };
+        double fieldOfView{ 0.0 };
+        //cos and sin of each column's angle relative to the heading
+        std::vector<double> offsetCos;
+        std::vector<double> offsetSin;
+
+        //heading and camera plane the directions below were built for
+        double dirX{ 0.0 };
+        double dirY{ 0.0 };
+        double cameraPlaneX{ 0.0 };
+        double cameraPlaneY{ 0.0 };
+        //ray directions with the same length as the direction vector, and the same with unit length for the floor caster
+        std::vector<double> rayDirX;
+        std::vector<double> rayDirY;
+        std::vector<float> unitDirX;
+        std::vector<float> unitDirY;
+    };
+    rayTable table;
+    //coverage buffer for the face span engine, see calcFaceSpans
+    std::vector<int> coverage;
+    int uncoveredColumns{ 0 };
+
 public:
 
     ~Character() = default;
@@ -108,6 +225,85 @@ public:
         charObject.move(xDistance, yDistance);
     }
 
+    /*
+    Move the character so its center is at a world position, keeping its direction.
+
+    Params:
+        x - world X coordinate of the new center.
+        y - world Y coordinate of the new center.
+    */
+    void teleport(float x, float y)
+    {
+        float xAdjustment = x - center.x;
+        float yAdjustment = y - center.y;
+        move(xAdjustment, yAdjustment);
+        center = sf::Vector2f(x, y);
+        for (auto& vertex : directionRay)
+        {
+            vertex.position = sf::Vector2f(vertex.position.x + xAdjustment, vertex.position.y + yAdjustment);
+        }
+        for (auto& vertex : cameraPlane)
+        {
+            vertex.position = sf::Vector2f(vertex.position.x + xAdjustment, vertex.position.y + yAdjustment);
+        }
+    }
+
+    /*
+    Save the character's position, direction, camera plane and ray settings.
+
+    Params:
+        state - set to the character's state.
+    */
+    void saveState(CharacterState& state) const
+    {
+        state.positionX = charObject.getPosition().x;
+        state.positionY = charObject.getPosition().y;
+        state.centerX = center.x;
+        state.centerY = center.y;
+        state.dirX = dirX;
+        state.dirY = dirY;
+        state.cameraPlaneX = cameraPlaneX;
+        state.cameraPlaneY = cameraPlaneY;
+        for (int i = 0; i < 2; ++i)
+        {
+            state.directionRay[i * 2] = directionRay[i].position.x;
+            state.directionRay[i * 2 + 1] = directionRay[i].position.y;
+            state.cameraPlane[i * 2] = cameraPlane[i].position.x;
+            state.cameraPlane[i * 2 + 1] = cameraPlane[i].position.y;
+        }
+        state.maxRayDistance = maxRayDistance;
+        state.maxRaySteps = maxRaySteps;
+        state.adaptiveStride = adaptiveStride;
+        state.engine = std::uint8_t(engine);
+        state.projection = std::uint8_t(projection);
+    }
+
+    /*
+    Restore a state saved by saveState, from this or any other character. Hits keep their old values until the next calcRays.
+
+    Params:
+        state - state to restore.
+    */
+    void restoreState(const CharacterState& state)
+    {
+        charObject.setPosition(state.positionX, state.positionY);
+        center = sf::Vector2f(state.centerX, state.centerY);
+        dirX = state.dirX;
+        dirY = state.dirY;
+        cameraPlaneX = state.cameraPlaneX;
+        cameraPlaneY = state.cameraPlaneY;
+        for (int i = 0; i < 2; ++i)
+        {
+            directionRay[i].position = sf::Vector2f(state.directionRay[i * 2], state.directionRay[i * 2 + 1]);
+            cameraPlane[i].position = sf::Vector2f(state.cameraPlane[i * 2], state.cameraPlane[i * 2 + 1]);
+        }
+        maxRayDistance = state.maxRayDistance;
+        maxRaySteps = state.maxRaySteps;
+        adaptiveStride = state.adaptiveStride;
+        engine = rayEngine(state.engine);
+        projection = projectionMode(state.projection);
+    }
+
     /*
     Get center coordinates of character object.
 
@@ -195,194 +391,749 @@ public:
     }
 
     /*
-    Determine distance along the ray to reach the next closest gridline for a given axis (X or Y).
-    This function operates on one axis. So to get the closest X or Y gridline you will have to run this function twice: 
-    once for the X axis and once for the Y axis and then compare to see which gridline is closer. 
+    Get the direction of the ray cast through a pixel column. Column 0 goes through the start of the camera plane
+    and column screenWidth through its end. The angular projections look the direction up in the ray table,
+    which must have been built for screenWidth with updateRayTable.
 
     Params:
-        vertex - current coordinate along axis we are measuring from. 
-        rayDir - Direction of ray, we really only care if going in negative (up and left) or positive direction (down and right). 
-        deltaDistance - distance between two parallel gridlines when traversing the ray. 
-     */
-    double calcNewDistance(int vertex, double rayDir, double deltaDist)
+        column - pixel column, 0 to screenWidth.
+        screenWidth - number of pixel columns in the 3D display.
+        rayDirX - set to X component of the ray direction.
+        rayDirY - set to Y component of the ray direction.
+    */
+    void calcRayDirection(int column, int screenWidth, double& rayDirX, double& rayDirY)
     {
-        double distance = int(vertex) % (int)BLOCK_WIDTH;
-        if (rayDir < 0 && distance == 0)
+        if (projection != PROJECTION_FLAT)
         {
-            distance = BLOCK_WIDTH;
+            rayDirX = table.rayDirX[column];
+            rayDirY = table.rayDirY[column];
+            return;
         }
-        else if (rayDir >= 0)
+        double cameraX = 2 * column / double(screenWidth) - 1;
+        rayDirX = dirX + cameraPlaneX * cameraX;
+        rayDirY = dirY + cameraPlaneY * cameraX;
+    }
+
+    /*
+    Build the ray direction table of the angular projections for a resolution, if the one built last does not match
+    the resolution, projection and heading. Does nothing for PROJECTION_FLAT.
+
+    Columns are spread evenly over the field of view, or the full circle for PROJECTION_PANORAMIC, and run the same way
+    round as the flat projection's camera plane. Every table ray has the length of the direction vector.
+
+    Params:
+        screenWidth - number of pixel columns in the 3D display.
+    */
+    void updateRayTable(int screenWidth)
+    {
+        if (projection == PROJECTION_FLAT)
         {
-            distance = BLOCK_WIDTH - distance;
-            if (distance == 0)
+            return;
+        }
+
+        double length = std::sqrt(dirX * dirX + dirY * dirY);
+        double fieldOfView = projection == PROJECTION_PANORAMIC ? 2 * PI : 2 * std::atan2(std::sqrt(cameraPlaneX * cameraPlaneX + cameraPlaneY * cameraPlaneY), length);
+        //+1 if the camera plane points counter clockwise from the direction, in which case column angles grow with the column
+        double turn = dirX * cameraPlaneY - dirY * cameraPlaneX < 0 ? -1.0 : 1.0;
+        if (table.columns != screenWidth || table.projection != projection || table.fieldOfView != fieldOfView * turn)
+        {
+            table.columns = screenWidth;
+            table.projection = projection;
+            table.fieldOfView = fieldOfView * turn;
+            table.offsetCos.resize(screenWidth + 1);
+            table.offsetSin.resize(screenWidth + 1);
+            for (int i = 0; i <= screenWidth; ++i)
             {
-                distance = BLOCK_WIDTH;
+                double angle = (i / double(screenWidth) - 0.5) * table.fieldOfView;
+                table.offsetCos[i] = std::cos(angle);
+                table.offsetSin[i] = std::sin(angle);
             }
+            //force the directions to be rebuilt
+            table.dirX = table.dirY = 0.0;
         }
-        return (distance / BLOCK_WIDTH) * deltaDist;
-    };
 
+        if (table.dirX != dirX || table.dirY != dirY || table.cameraPlaneX != cameraPlaneX || table.cameraPlaneY != cameraPlaneY || table.rayDirX.size() != table.offsetCos.size())
+        {
+            table.dirX = dirX;
+            table.dirY = dirY;
+            table.cameraPlaneX = cameraPlaneX;
+            table.cameraPlaneY = cameraPlaneY;
+            table.rayDirX.resize(screenWidth + 1);
+            table.rayDirY.resize(screenWidth + 1);
+            table.unitDirX.resize(screenWidth + 1);
+            table.unitDirY.resize(screenWidth + 1);
+            double headingX = dirX / length;
+            double headingY = dirY / length;
+            for (int i = 0; i <= screenWidth; ++i)
+            {
+                double unitX = headingX * table.offsetCos[i] - headingY * table.offsetSin[i];
+                double unitY = headingY * table.offsetCos[i] + headingX * table.offsetSin[i];
+                table.rayDirX[i] = unitX * length;
+                table.rayDirY[i] = unitY * length;
+                table.unitDirX[i] = float(unitX);
+                table.unitDirY[i] = float(unitY);
+            }
+        }
+    }
 
     /*
-    Check if the current location intersects with a wall and if so record the intersection details. 
+    Project a world position onto the screen with the current projection.
 
     Params:
-        xIndex - X coordinate we are testing.
-        yIndex - Y coordinate we are testing. 
-        hitDetail - if intersection occurred, object that will store intersection details.
-        worldMap - 2D vector describing the environment 
+        x - world X coordinate.
+        y - world Y coordinate.
+        screenWidth - number of pixel columns in the 3D display.
+        screenX - set to the fractional column the position is seen in.
+        depth - set to the distance hits use for the same position: from the camera plane for PROJECTION_FLAT,
+            from the character center for the angular projections.
     Returns:
-        True if intersection occurred, otherwise false. 
-     */
-    bool checkForHit(double xIndex, double yIndex, hitDetails& hitDetail, std::vector<std::vector<int>>& worldMap)
+        False if the position is behind the character in the flat projection.
+    */
+    bool projectPoint(double x, double y, int screenWidth, double& screenX, double& depth)
     {
-        bool hit{false};
+        double relativeX = x - center.x;
+        double relativeY = y - center.y;
+        double length = std::sqrt(dirX * dirX + dirY * dirY);
+        if (projection == PROJECTION_FLAT)
+        {
+            //depth along the direction ray and offset along the camera plane
+            double planeLength = std::sqrt(cameraPlaneX * cameraPlaneX + cameraPlaneY * cameraPlaneY);
+            depth = (relativeX * dirX + relativeY * dirY) / length;
+            if (depth <= 0)
+            {
+                return false;
+            }
+            double lateral = (relativeX * cameraPlaneX + relativeY * cameraPlaneY) / planeLength;
+
+            //column i is cast through cameraX = 2 * i / screenWidth - 1
+            double cameraX = (lateral / depth) * (length / planeLength);
+            screenX = (cameraX + 1.0) * screenWidth / 2.0;
+            return true;
+        }
+
+        updateRayTable(screenWidth);
+        double angle = std::atan2(dirX * relativeY - dirY * relativeX, dirX * relativeX + dirY * relativeY);
+        depth = std::sqrt(relativeX * relativeX + relativeY * relativeY);
+        screenX = (angle / table.fieldOfView + 0.5) * screenWidth;
+        return true;
+    }
+
+    /*
+    Work out where a ray meets the wall face recorded in hitDetail, and its distance from the camera plane.
+    The point is computed from the face's grid line rather than from the stepping, so any ray known to hit 
+    the same face gets exactly the same result whether it was stepped through the map or not.
+
+    In the angular projections every ray has the length of dir, so the same formula gives the distance from the character instead,
+    which is what their wall heights are proportional to.
+
+    Every ray is dir + cameraPlane * cameraX and the camera plane is perpendicular to dir, so travelling n ray lengths 
+    moves n * |dir| away from the camera plane. Using that distance instead of the length along the ray keeps straight walls 
+    straight on screen (no fisheye) and needs no square root.
 
-        //double intersection
-        if (std::floor(xIndex) == xIndex && std::floor(yIndex) == yIndex)
+    Computed with the block size and coordinate type castColumnAs stepped the ray in, BLOCK_PIXELS and double by default.
+
+    Params:
+        hitDetail - hit with cellX, cellY and alignment set. distance and inverseDistance are filled in.
+        rayDirX - X component of the ray direction.
+        rayDirY - Y component of the ray direction.
+    Returns:
+        Coordinates where the ray hits the wall.
+    */
+    template <int BlockSize = BLOCK_PIXELS, typename Coordinate = double>
+    sf::Vector2f resolveHit(hitDetails& hitDetail, double rayDirX, double rayDirY)
+    {
+        const Coordinate blockWidth = Coordinate(BlockSize);
+        //how many ray direction lengths we travel to reach the face
+        Coordinate rayLengths;
+        if (hitDetail.alignment == hitDetail.vertical)
+        {
+            Coordinate faceX = (rayDirX < 0 ? hitDetail.cellX + 1 : hitDetail.cellX) * blockWidth;
+            rayLengths = (faceX - Coordinate(center.x)) / Coordinate(rayDirX);
+        }
+        else
         {
-            int x = xIndex;
-            int y = yIndex;
+            Coordinate faceY = (rayDirY < 0 ? hitDetail.cellY + 1 : hitDetail.cellY) * blockWidth;
+            rayLengths = (faceY - Coordinate(center.y)) / Coordinate(rayDirY);
+        }
+        hitDetail.distance = rayLengths * dirLength;
+        hitDetail.inverseDistance = inverseDirLength / rayLengths;
+        return sf::Vector2f(center.x + rayDirX * rayLengths, center.y + rayDirY * rayLengths);
+    }
+
+    /*
+    Cast the ray for one pixel column through the map, one grid cell at a time, until it enters a wall.
+    The ray gives up when it would pass maxRayDistance or maxRaySteps, and the grid's sentinel border stops it
+    at the edge of the map, so the loop needs no bounds checks. Transparent walls are recorded in the column's layers
+    and the ray carries on behind them; only non-empty cells pay for that check.
+
+    Specialized on the block size in world pixels, so the camera's cell is found with a shift for power of two sizes, and
+    on the type the ray is stepped and its hit resolved in. castColumn uses BLOCK_PIXELS and double: float is no measurably faster, since a
+    step is bound by its dependent compare and cell load rather than by arithmetic width, and its distances are only good
+    to about 1e-7, which falls off further with distance from the map origin.
+
+    Params:
+        column - pixel column, 0 to screenWidth.
+        screenWidth - number of pixel columns in the 3D display.
+        grid - map to cast through.
+        endPoint - set to coordinates where the ray hits the wall, or where it gave up.
+    Returns:
+        Details of the wall face hit. color is 0 if nothing was hit.
+     */
+    template <int BlockSize, typename Coordinate>
+    hitDetails castColumnAs(int column, int screenWidth, const WorldGrid& grid, sf::Vector2f& endPoint)
+    {
+        const Coordinate blockWidth = Coordinate(BlockSize);
+        const Coordinate far = Coordinate(1e30);
+        double rayDirX, rayDirY;
+        calcRayDirection(column, screenWidth, rayDirX, rayDirY);
+        Coordinate dirX = Coordinate(rayDirX);
+        Coordinate dirY = Coordinate(rayDirY);
+        Coordinate centerX = Coordinate(center.x);
+        Coordinate centerY = Coordinate(center.y);
+
+        //map cell the ray is currently in, from the whole pixel the center is in
+        int mapX = CellIndexing<BlockSize>::cell(int(center.x));
+        int mapY = CellIndexing<BlockSize>::cell(int(center.y));
+        //ray direction lengths that take the ray maxRayDistance away from the camera plane
+        Coordinate maxRayLengths = Coordinate(maxRayDistance * inverseDirLength);
+
+        //how many ray direction lengths it takes to cross one cell along each axis
+        Coordinate deltaDistX = (dirX == 0) ? far : std::abs(blockWidth / dirX);
+        Coordinate deltaDistY = (dirY == 0) ? far : std::abs(blockWidth / dirY);
+        int stepX = dirX < 0 ? -1 : 1;
+        int stepY = dirY < 0 ? -1 : 1;
+
+        //ray direction lengths to reach the first X and Y gridline
+        Coordinate sideDistX = (dirX == 0) ? far : dirX < 0 ? (centerX - mapX * blockWidth) / -dirX : ((mapX + 1) * blockWidth - centerX) / dirX;
+        Coordinate sideDistY = (dirY == 0) ? far : dirY < 0 ? (centerY - mapY * blockWidth) / -dirY : ((mapY + 1) * blockWidth - centerY) / dirY;
 
-            if (worldMap[y][x] != 0)
+        hitDetails hit;
+        if (grid.contains(mapX, mapY))
+        {
+            const int* cells = grid.paddedData();
+            int index = grid.paddedIndex(mapX, mapY);
+            int stepIndexY = stepY * grid.getStride();
+            for (int step = 0; step < maxRaySteps && hit.color == 0; ++step)
             {
-                hit = true;
-                hitDetail.color = worldMap[y][x];
+                //step into whichever cell the ray reaches first. Crossing an X gridline means we face a vertical wall. 
+                if (sideDistX < sideDistY)
+                {
+                    if (sideDistX > maxRayLengths)
+                    {
+                        break;
+                    }
+                    sideDistX += deltaDistX;
+                    mapX += stepX;
+                    index += stepX;
+                    hit.alignment = hit.vertical;
+                }
+                else
+                {
+                    if (sideDistY > maxRayLengths)
+                    {
+                        break;
+                    }
+                    sideDistY += deltaDistY;
+                    mapY += stepY;
+                    index += stepIndexY;
+                    hit.alignment = hit.horizontal;
+                }
+                hit.color = cells[index];
+                if (hit.color != 0 && isTransparentMaterial(hit.color))
+                {
+                    if (hit.layerCount < MAX_TRANSPARENT_LAYERS)
+                    {
+                        hitDetails& layer = layers[column][hit.layerCount++];
+                        layer.color = hit.color;
+                        layer.alignment = hit.alignment;
+                        layer.cellX = mapX;
+                        layer.cellY = mapY;
+                        resolveHit<BlockSize, Coordinate>(layer, rayDirX, rayDirY);
+                    }
+                    hit.color = 0;
+                }
             }
-            else if (worldMap[y - 1][x - 1] != 0)
-            {
-                hit = true;
-                hitDetail.color = worldMap[y - 1][x - 1];
+        }
+
+        if (hit.color <= 0)
+        {
+            //left the map, ran out of distance or steps
+            int layerCount = hit.layerCount;
+            hit = hitDetails();
+            hit.layerCount = layerCount;
+            hit.cellX = -1;
+            hit.cellY = -1;
+            hit.distance = maxRayDistance;
+            hit.inverseDistance = 1 / maxRayDistance;
+            endPoint = sf::Vector2f(center.x + rayDirX * maxRayLengths, center.y + rayDirY * maxRayLengths);
+            return hit;
+        }
+        hit.cellX = mapX;
+        hit.cellY = mapY;
+        endPoint = resolveHit<BlockSize, Coordinate>(hit, rayDirX, rayDirY);
+        return hit;
+    }
+
+    /*
+    Cast the ray for one pixel column with the kernel specialized for this build's block size, see castColumnAs.
+    */
+    hitDetails castColumn(int column, int screenWidth, const WorldGrid& grid, sf::Vector2f& endPoint)
+    {
+        return castColumnAs<BLOCK_PIXELS, double>(column, screenWidth, grid, endPoint);
+    }
+
+    /*
+    Fill in the columns strictly between two cast columns. If both hit the same face of the same cell every ray between them hits it too, 
+    since no wall cell fits inside the narrow triangle they form with the character, so those columns are computed directly from the face.
+    That only holds for rays less than half a turn apart, which the panoramic projection can exceed at low resolutions.
+    Otherwise, or if the rays hit nothing or passed through transparent walls, the middle column is cast and each half is handled the same way. 
 
+    Params:
+        hits - per column hits being filled in.
+        left - column already cast.
+        right - column already cast, greater than left.
+        screenWidth - number of pixel columns in the 3D display.
+        grid - map to cast through.
+        casts - incremented for every column cast.
+    */
+    void fillColumns(std::vector<hitDetails>& hits, int left, int right, int screenWidth, const WorldGrid& grid, int& casts)
+    {
+        if (right - left <= 1)
+        {
+            return;
+        }
+
+        const hitDetails& leftHit = hits[left];
+        const hitDetails& rightHit = hits[right];
+        bool narrow = projection != PROJECTION_PANORAMIC || 2 * (right - left) < screenWidth;
+        if (narrow && leftHit.color != 0 && leftHit.layerCount == 0 && rightHit.layerCount == 0 && leftHit.cellX == rightHit.cellX && leftHit.cellY == rightHit.cellY && leftHit.alignment == rightHit.alignment)
+        {
+            for (int i = left + 1; i < right; ++i)
+            {
+                double rayDirX, rayDirY;
+                calcRayDirection(i, screenWidth, rayDirX, rayDirY);
+                hits[i] = leftHit;
+                rayCasts[i] = resolveHit(hits[i], rayDirX, rayDirY);
             }
-            else if (worldMap[y][x - 1] != 0)
+            return;
+        }
+
+        int middle = (left + right) / 2;
+        hits[middle] = castColumn(middle, screenWidth, grid, rayCasts[middle].position);
+        ++casts;
+        fillColumns(hits, left, middle, screenWidth, grid, casts);
+        fillColumns(hits, middle, right, screenWidth, grid, casts);
+    }
+
+    /*
+    Get the screen column a point in the world projects to, using the same projection as calcRayDirection.
+
+    Params:
+        x - world X coordinate, must be in front of the character.
+        y - world Y coordinate, must be in front of the character.
+        screenWidth - number of pixel columns in the 3D display.
+    Returns:
+        Fractional column, outside 0 to screenWidth when the point is outside the field of view.
+    */
+    double projectToColumn(double x, double y, int screenWidth)
+    {
+        double relativeX = x - center.x;
+        double relativeY = y - center.y;
+        double depth = (relativeX * dirX + relativeY * dirY) / (dirX * dirX + dirY * dirY);
+        double lateral = (relativeX * cameraPlaneX + relativeY * cameraPlaneY) / (cameraPlaneX * cameraPlaneX + cameraPlaneY * cameraPlaneY);
+        return (lateral / depth + 1) * screenWidth / 2.0;
+    }
+
+    /*
+    Find the first column at or after column that has no hit yet, skipping covered runs. 
+    */
+    int nextUncovered(int column)
+    {
+        while (coverage[column] != column)
+        {
+            coverage[column] = coverage[coverage[column]];
+            column = coverage[column];
+        }
+        return column;
+    }
+
+    /*
+    Project one wall face onto the screen and give every uncovered column in its span a hit on that face. 
+    Columns at the ends of the span may clip the face's corner or belong to a neighbouring face, so they are cast instead.
+    So are columns where the face is at about maxRayDistance, where castColumn decides whether the ray gets that far,
+    and every column of a transparent face, since castColumn also finds what lies behind it.
+    A face reaching closer than the near plane projects out to the edge of the screen past its clipped end,
+    and every one of those columns is cast too; a face entirely inside the near plane casts every uncovered column.
+
+    Params:
+        hits - per column hits being filled in.
+        startX, startY, endX, endY - end points of the face in world coordinates.
+        face - hit to record with color, cell and alignment set. 
+        screenWidth - number of pixel columns in the 3D display.
+        grid - map to cast through.
+    */
+    void drawFaceSpan(std::vector<hitDetails>& hits, double startX, double startY, double endX, double endY, const hitDetails& face, int screenWidth, const WorldGrid& grid)
+    {
+        //clip the face against a plane just in front of the character so both ends project
+        const double nearDepth = 1e-3;
+        double startDepth = ((startX - center.x) * dirX + (startY - center.y) * dirY) / (dirX * dirX + dirY * dirY);
+        double endDepth = ((endX - center.x) * dirX + (endY - center.y) * dirY) / (dirX * dirX + dirY * dirY);
+        if (startDepth <= 0 && endDepth <= 0)
+        {
+            return;
+        }
+
+        //columns outside castLow to castHigh see the face closer than the near plane, where projecting it is unreliable
+        double castLow = -2.0;
+        double castHigh = screenWidth + 2.0;
+        double low = castLow;
+        double high = castHigh;
+        if (startDepth < nearDepth && endDepth < nearDepth)
+        {
+            castLow = castHigh;
+        }
+        else
+        {
+            bool clipStart = startDepth < nearDepth;
+            bool clipEnd = endDepth < nearDepth;
+            if (clipStart)
             {
-                hit = true;
-                hitDetail.color = worldMap[y][x - 1];
+                double t = (nearDepth - startDepth) / (endDepth - startDepth);
+                startX += (endX - startX) * t;
+                startY += (endY - startY) * t;
             }
-            else if (worldMap[y - 1][x] != 0)
+            else if (clipEnd)
             {
-                hit = true;
-                hitDetail.color = worldMap[y - 1][x];
+                double t = (nearDepth - endDepth) / (startDepth - endDepth);
+                endX += (startX - endX) * t;
+                endY += (startY - endY) * t;
             }
-        }
-        else if (std::floor(xIndex) == xIndex)
-        {
-            int x = xIndex;
-            int y = std::floor(yIndex);
-            if (worldMap[y][x] != 0 || worldMap[y][x - 1] != 0)
+
+            double startColumn = projectToColumn(startX, startY, screenWidth);
+            double endColumn = projectToColumn(endX, endY, screenWidth);
+            low = std::min(std::max(std::min(startColumn, endColumn), castLow), castHigh);
+            high = std::min(std::max(std::max(startColumn, endColumn), castLow), castHigh);
+            //the clipped part of the face carries on past the clipped end, away from the other end
+            if (clipStart || clipEnd)
             {
-                hitDetail.alignment = hitDetail.vertical;
-                hit = true;
-                if (worldMap[y][x] != 0)
+                double clipped = clipStart ? startColumn : endColumn;
+                double other = clipStart ? endColumn : startColumn;
+                if (clipped < other)
                 {
-                    hitDetail.color = worldMap[y][x];
+                    castLow = low;
+                    low = -2.0;
                 }
                 else
                 {
-                    hitDetail.color = worldMap[y][x - 1];
+                    castHigh = high;
+                    high = screenWidth + 2.0;
                 }
             }
         }
-        else if (std::floor(yIndex) == yIndex)
+        int first = int(std::ceil(low));
+        int last = int(std::floor(high));
+
+        for (int i = nextUncovered(std::max(first - 1, 0)); i <= std::min(last + 1, screenWidth); i = nextUncovered(i + 1))
         {
-            int y = yIndex;
-            int x = std::floor(xIndex);
-            if (worldMap[y][x] != 0 || worldMap[y - 1][x] != 0)
+            bool cast = i <= first || i >= last || i <= castLow || i >= castHigh || face.layerCount != 0;
+            if (!cast)
+            {
+                double rayDirX, rayDirY;
+                calcRayDirection(i, screenWidth, rayDirX, rayDirY);
+                hits[i] = face;
+                rayCasts[i] = resolveHit(hits[i], rayDirX, rayDirY);
+                cast = hits[i].distance > maxRayDistance * 0.999;
+            }
+            if (cast)
             {
-                hitDetail.alignment = hitDetail.horizontal;
-                hit = true;
-                hitDetail.color = worldMap[y][x] ? worldMap[y][x] : worldMap[y - 1][x];
+                hits[i] = castColumn(i, screenWidth, grid, rayCasts[i].position);
+                ++castCount;
             }
+            coverage[i] = i + 1;
+            --uncoveredColumns;
         }
-        return hit;
     }
 
     /*
-    Calculate ray distances for each screen pixel and color of surface being hit.
+    Calculate hits by visiting wall faces front to back instead of casting a ray per column.
+
+    Cells are visited in rings of increasing Manhattan distance from the character's cell. Every step a ray takes through the grid
+    moves it one ring further out, so a face in an inner ring is always in front of any face in an outer ring that shares a column.
+    Each face seen from the character covers a span of columns and the coverage buffer skips columns already hit, 
+    so the sweep stops as soon as every column is covered. A ray reaches ring n after n steps, so the sweep stops at maxRaySteps too.
+    Gives the same hits as castColumn.
+
+    Params:
+        hits - filled with one entry per column, screenWidth + 1 in total.
+        screenWidth - number of pixel columns in the 3D display.
+        grid - map to cast through.
     */
-    std::vector<sf::Vertex> calcRays( std::vector<hitDetails>& hits, int screenWidth, std::vector<std::vector<int>>& worldMap)
+    void calcFaceSpans(std::vector<hitDetails>& hits, int screenWidth, const WorldGrid& grid)
     {
-        hits.clear();
-        std::vector<sf::Vertex> rayCasts;
+        //coverage[i] is i while column i has no hit, otherwise it points further right towards the next column without one
+        coverage.resize(screenWidth + 2);
+        for (int i = 0; i <= screenWidth + 1; ++i)
+        {
+            coverage[i] = i;
+        }
+        uncoveredColumns = screenWidth + 1;
 
-        //Each column of pixels in the screen gets a calculation. calculate the size of wall seen for that column and its color. Creates illusion of 3D.  
-        for (double i = 0; i <= screenWidth; ++i)
+        int mapWidth = grid.getWidth();
+        int mapHeight = grid.getHeight();
+        int cameraX = CellIndexing<BLOCK_PIXELS>::cell(int(center.x));
+        int cameraY = CellIndexing<BLOCK_PIXELS>::cell(int(center.y));
+        int maxRing = std::max(cameraX, mapWidth - 1 - cameraX) + std::max(cameraY, mapHeight - 1 - cameraY);
+        maxRing = grid.contains(cameraX, cameraY) ? std::min(maxRing, maxRaySteps) : 0;
+
+        for (int ring = 1; ring <= maxRing && uncoveredColumns > 0; ++ring)
         {
-            //map position that will change over time 
-            int mapX = int(center.x);
-            int mapY = int(center.y);
-
-            //determine where in the camera plane our ray for the pixel column intersects
-            double cameraX = 2 * i / double(screenWidth) - 1;
-            double rayDirX = dirX + cameraPlaneX * cameraX;
-            double rayDirY = dirY + cameraPlaneY * cameraX;
-
-            //determine deltaDistX and deltaDistX. The deltas can be describe as hypoteneus created by X and Y direction rays. 
-            double hypoLength = sqrt(rayDirX * rayDirX + rayDirY * rayDirY);
-            double xMultiplier = 32.0f / std::abs(rayDirX);
-            double yMultiplier = 32.0f / std::abs(rayDirY);
-            double deltaDistX = (rayDirX == 0) ? 1e30 : xMultiplier * hypoLength;
-            double deltaDistY = (rayDirY == 0) ? 1e30 : yMultiplier * hypoLength;
-
-            //apply + and - valuse to deltas. Up and Left are (-). Right and Down are (+).
-            deltaDistX = rayDirX < 0 ? deltaDistX * -1 : deltaDistX;
-            deltaDistY = rayDirY < 0 ? deltaDistY * -1 : deltaDistY;
-
-            //calculate initial distances to sides. TODO: make readable. 
-            double sideDistX = rayDirX < 0 ? ((int(center.x) % 32) / 32.0f) * deltaDistX :
-                ((32.0f - (int(center.x) % 32)) / 32.0f) * deltaDistX;
-            double sideDistY = rayDirY < 0 ? ((int(center.y) % 32) / 32.0f) * deltaDistY :
-                ((32.0f - (int(center.y) % 32)) / 32.0f) * deltaDistY;
-
-            bool hit{ false };
-
-            hitDetails temp;
-            while (!hit)
+            for (int offsetX = -ring; offsetX <= ring; ++offsetX)
             {
-                //determine which is closer along the ray's path: intersecting a Y or X grid line. 
-                double adjustmentDistance = (std::abs(sideDistX) <= std::abs(sideDistY)) ? sideDistX : sideDistY;
-                //determine how far along ray we must travel to reach the next intersection. 
-                double adjustment = (adjustmentDistance / deltaDistX) * 32.0;
-
-                double signOperator = deltaDistX > 0 ? 1 : -1;
-                adjustment = std::abs(adjustment) * signOperator;
-                mapX += std::round(adjustment);
-
-                signOperator = deltaDistY > 0 ? 1 : -1;
-                adjustment = std::abs((adjustmentDistance / deltaDistY) * 32.f) * signOperator;
-                mapY += std::round(adjustment);
-
-                //now calc the new distances to X and Y grids after moving
-                sideDistX = calcNewDistance(mapX, rayDirX, deltaDistX);
-                sideDistY = calcNewDistance(mapY, rayDirY, deltaDistY);
-
-                //check against world map to see what block we are up against 
-                double xIndex = mapX / 32.0f;
-                double yIndex = mapY / 32.0f;
-                hit = checkForHit(xIndex, yIndex, temp, worldMap);
-                if (i && hit && temp.alignment == temp.unknown)
+                int rest = ring - std::abs(offsetX);
+                for (int offsetY : { -rest, rest })
                 {
-                    temp.alignment = hits[i-1].alignment;
+                    int x = cameraX + offsetX;
+                    int y = cameraY + offsetY;
+                    if (!grid.contains(x, y) || grid.at(x, y) == 0)
+                    {
+                        if (rest == 0) break;
+                        continue;
+                    }
+
+                    hitDetails face;
+                    face.color = grid.at(x, y);
+                    //marks a transparent face for drawFaceSpan, which casts its columns instead of filling them
+                    face.layerCount = isTransparentMaterial(face.color) ? 1 : 0;
+                    face.cellX = x;
+                    face.cellY = y;
+
+                    //the vertical face towards the character, unless it is shared with a wall in front of it.
+                    //The character's own cell never hides a face, even if the character walked into a wall.
+                    int nearX = offsetX > 0 ? x - 1 : x + 1;
+                    if (offsetX != 0 && (grid.at(nearX, y) == 0 || (nearX == cameraX && y == cameraY)))
+                    {
+                        double faceX = (offsetX > 0 ? x : x + 1) * BLOCK_WIDTH;
+                        face.alignment = face.vertical;
+                        drawFaceSpan(hits, faceX, y * BLOCK_WIDTH, faceX, (y + 1) * BLOCK_WIDTH, face, screenWidth, grid);
+                    }
+
+                    //the horizontal face towards the character
+                    int nearY = offsetY > 0 ? y - 1 : y + 1;
+                    if (offsetY != 0 && (grid.at(x, nearY) == 0 || (x == cameraX && nearY == cameraY)))
+                    {
+                        double faceY = (offsetY > 0 ? y : y + 1) * BLOCK_WIDTH;
+                        face.alignment = face.horizontal;
+                        drawFaceSpan(hits, x * BLOCK_WIDTH, faceY, (x + 1) * BLOCK_WIDTH, faceY, face, screenWidth, grid);
+                    }
+
+                    if (rest == 0)
+                    {
+                        break;
+                    }
                 }
             }
-            //calc distance for each ray 
-            double startX = center.x;
-            double startY = center.y;
-            double endX = mapX;
-            double endY = mapY;
-            double distance = std::sqrt((startX - endX) * (startX - endX) + (startY - endY) * (startY - endY));
-            temp.distance = distance;
-            rayCasts.push_back(sf::Vector2f(mapX, mapY));
-            hits.push_back(temp);
         }
+
+        //anything the sweep missed, e.g. rays leaving a map that is not enclosed, is cast directly
+        for (int i = nextUncovered(0); i <= screenWidth; i = nextUncovered(i + 1))
+        {
+            hits[i] = castColumn(i, screenWidth, grid, rayCasts[i].position);
+            ++castCount;
+            coverage[i] = i + 1;
+        }
+    }
+
+    /*
+    Size the per column buffers for a new set of hits and cache values shared by every column.
+    Must be called before castColumnRange.
+
+    Params:
+        hits - resized to screenWidth + 1 entries.
+        screenWidth - number of pixel columns in the 3D display.
+    */
+    void beginColumns(std::vector<hitDetails>& hits, int screenWidth)
+    {
+        hits.resize(screenWidth + 1);
+        layers.resize(screenWidth + 1);
+        rayCasts.resize(screenWidth + 1);
+        castCount = 0;
+        dirLength = std::sqrt(dirX * dirX + dirY * dirY);
+        inverseDirLength = 1 / dirLength;
+        updateRayTable(screenWidth);
+    }
+
+    /*
+    Calculate hits for columns first to last with the adaptive stride, see calcRays. Only touches those columns,
+    so disjoint ranges of the same character can be cast on different threads after beginColumns.
+
+    Params:
+        hits - per column hits being filled in.
+        first - first column of the range.
+        last - last column of the range, inclusive.
+        screenWidth - number of pixel columns in the 3D display.
+        grid - map to cast through.
+    Returns:
+        Number of columns stepped through the map.
+    */
+    int castColumnRange(std::vector<hitDetails>& hits, int first, int last, int screenWidth, const WorldGrid& grid)
+    {
+        int casts = 0;
+        int stride = std::max(adaptiveStride, 1);
+        int previous = first;
+        for (int i = first; ; i = std::min(i + stride, last))
+        {
+            hits[i] = castColumn(i, screenWidth, grid, rayCasts[i].position);
+            ++casts;
+            fillColumns(hits, previous, i, screenWidth, grid, casts);
+            previous = i;
+            if (i == last)
+            {
+                break;
+            }
+        }
+        return casts;
+    }
+
+    /*
+    Calculate ray distances for each screen pixel and color of surface being hit.
+
+    With an adaptive stride above 1 only every stride-th column is cast up front, and the columns in between are either
+    computed from the wall face both neighbours hit or cast by bisecting where the hit cell or face changes. The result is
+    identical to casting every column. The FACE_SPANS engine fills the same hits from visible wall faces instead.
+    It projects faces through the camera plane, so the angular projections always cast columns.
+
+    Params:
+        hits - filled with one entry per column, screenWidth + 1 in total.
+        screenWidth - number of pixel columns in the 3D display.
+        grid - map to cast through.
+    Returns:
+        Coordinates where each column's ray hits a wall.
+    */
+    std::vector<sf::Vertex> calcRays( std::vector<hitDetails>& hits, int screenWidth, const WorldGrid& grid)
+    {
+        TRACE_ZONE("calcRays");
+        beginColumns(hits, screenWidth);
+
+        if (sweepsFaceSpans())
+        {
+            calcFaceSpans(hits, screenWidth, grid);
+            return rayCasts;
+        }
+
+        //Each column of pixels in the screen gets a calculation. calculate the size of wall seen for that column and its color. Creates illusion of 3D.  
+        castCount = castColumnRange(hits, 0, screenWidth, screenWidth, grid);
         return rayCasts;
     }
 
+    /*
+    Select how calcRays finds wall hits. 
+    */
+    void setRayEngine(rayEngine newEngine)
+    {
+        engine = newEngine;
+    }
+
+    rayEngine getRayEngine() const
+    {
+        return engine;
+    }
+
+    /*
+    Returns:
+        True if calcRays uses the FACE_SPANS engine, which needs the flat projection.
+    */
+    bool sweepsFaceSpans() const
+    {
+        return engine == FACE_SPANS && projection == PROJECTION_FLAT;
+    }
+
+    /*
+    Select how screen columns map to ray directions. 
+    */
+    void setProjection(projectionMode newProjection)
+    {
+        projection = newProjection;
+    }
+
+    projectionMode getProjection() const
+    {
+        return projection;
+    }
+
+    /*
+    Get unit length ray directions of the angular projections, one per column of the last updateRayTable call.
+    */
+    const std::vector<float>& getUnitRayX() const
+    {
+        return table.unitDirX;
+    }
+
+    const std::vector<float>& getUnitRayY() const
+    {
+        return table.unitDirY;
+    }
+
+    /*
+    Set how many columns apart calcRays casts its initial rays. 1 casts every column.
+    */
+    void setAdaptiveStride(int stride)
+    {
+        adaptiveStride = stride;
+    }
+
+    /*
+    Set how far rays travel before giving up. Walls further away than distance, measured from the camera plane,
+    or more than steps cells away are not drawn.
+    */
+    void setMaxRayDistance(double distance, int steps)
+    {
+        maxRayDistance = distance;
+        maxRaySteps = steps;
+    }
+
+    /*
+    Returns:
+        Number of columns the last calcRays call stepped through the map, the rest were filled in from wall faces.
+    */
+    int getCastCount() const
+    {
+        return castCount;
+    }
+
+    /*
+    Get direction vector relative to character center.
+
+    Returns:
+        Vector2 of X and Y direction components.
+    */
+    sf::Vector2<double> getDirectionVector()
+    {
+        return sf::Vector2<double>(dirX, dirY);
+    }
+
+    /*
+    Get camera plane vector relative to the end of the direction ray. Rays are cast from direction - plane to direction + plane.
+
+    Returns:
+        Vector2 of X and Y camera plane components.
+    */
+    sf::Vector2<double> getCameraPlaneVector()
+    {
+        return sf::Vector2<double>(cameraPlaneX, cameraPlaneY);
+    }
+
     auto& getHits() {
         return hits;
     }
 
+    /*
+    Get the transparent walls in front of each column's hit. Column i has getHits()[i].layerCount entries, nearest first.
+    */
+    auto& getLayers()
+    {
+        return layers;
+    }
+
     auto& getCenter()
     {
         return center;
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <algorithm>
+#include <SFML/System/Clock.hpp>
+
+//column counts are kept to multiples of this so SIMD loops over a row have no remainder
+static constexpr int COLUMN_GRANULARITY = 8;
+
+/*
+Chooses how many columns the 3D view casts each frame so raycasting and filling stay within a frame time budget.
+
+The controller keeps a running estimate of the cost of one column and picks the column count that fits the budget.
+Estimates react quickly when a frame goes over budget and slowly when there is spare time, and the column count changes
+by at most a tenth per frame, so the resolution drops immediately in busy scenes but does not oscillate.
+The 3D view is rendered with the chosen number of columns and stretched to the window width.
+*/
+class DynamicResolution
+{
+
+private:
+
+    float targetMilliseconds;
+    int minColumns;
+    int maxColumns;
+    int columns;
+
+    //running estimate of milliseconds spent per column, 0 until the first measurement
+    double costPerColumn{ 0.0 };
+
+public:
+
+    /*
+    Params:
+        targetMilliseconds - frame time budget for raycasting and filling.
+        minColumns - lowest horizontal resolution allowed.
+        maxColumns - highest horizontal resolution allowed, usually the window width.
+    */
+    DynamicResolution(float targetMilliseconds, int minColumns, int maxColumns) :
+        targetMilliseconds(targetMilliseconds), minColumns(minColumns), maxColumns(maxColumns), columns(maxColumns)
+    {
+    }
+
+    /*
+    Feed in the time the last frame took and pick the column count for the next one.
+
+    Params:
+        frameTime - time spent raycasting and filling the last frame.
+    */
+    void update(sf::Time frameTime)
+    {
+        double milliseconds = frameTime.asMicroseconds() / 1000.0;
+        double measuredCost = milliseconds / columns;
+        double blend = milliseconds > targetMilliseconds ? 0.5 : 0.1;
+        costPerColumn = costPerColumn == 0.0 ? measuredCost : costPerColumn + (measuredCost - costPerColumn) * blend;
+        if (costPerColumn <= 0.0)
+        {
+            return;
+        }
+
+        int wanted = int(targetMilliseconds / costPerColumn);
+        int maxChange = std::max(columns / 10, COLUMN_GRANULARITY);
+        wanted = std::min(std::max(wanted, columns - maxChange), columns + maxChange);
+        wanted -= wanted % COLUMN_GRANULARITY;
+        columns = std::min(std::max(wanted, minColumns), maxColumns);
+    }
+
+    /*
+    Returns:
+        Number of columns to cast this frame.
+    */
+    int getColumns() const
+    {
+        return columns;
+    }
+
+    void setTargetMilliseconds(float milliseconds)
+    {
+        targetMilliseconds = milliseconds;
+    }
+};
@@ -0,0 +1,271 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "Character.h"
+#include "WorldGrid.h"
+
+/*
+Cells of the map the character can see, and every cell it has seen so far, as bitsets.
+
+Visibility is computed with symmetric shadowcasting from the center of the character's cell: each of the four quadrants
+is scanned row by row outwards, and walls narrow the range of slopes the next rows are scanned over. Slopes are exact
+fractions, and a floor cell only counts as seen if its center is inside the range, so a cell sees another exactly when
+the other sees it back. Transparent walls are revealed but do not block sight. Cells are then kept if they touch the
+field of view cone.
+
+The set is only recomputed when the character enters another cell or its heading moves to another of HEADING_BUCKETS
+buckets. The cone is built around the middle of the bucket and widened by half a bucket, so it covers any heading in it.
+*/
+class FieldOfView
+{
+
+private:
+
+    static constexpr int HEADING_BUCKETS = 32;
+
+    const WorldGrid& grid;
+    int width;
+    int height;
+    int wordsPerRow;
+    std::vector<std::uint64_t> visible;
+    std::vector<std::uint64_t> explored;
+
+    //character the set was computed for, and what it was computed from
+    const Character* viewer{ nullptr };
+    int originX{ -1 };
+    int originY{ -1 };
+    int headingBucket{ -1 };
+    projectionMode projection{ PROJECTION_FLAT };
+    bool dirty{ true };
+
+    //cone the visible cells are cut down to
+    double coneAngle{ 0.0 };
+    double coneHalfAngle{ 0.0 };
+
+    //scanned row of a quadrant: cells from startSlope to endSlope at depth rows from the origin, slopes as fractions
+    struct scanRow
+    {
+        int depth;
+        int startNumerator;
+        int startDenominator;
+        int endNumerator;
+        int endDenominator;
+    };
+    std::vector<scanRow> pending;
+
+    static int floorDivide(int numerator, int denominator)
+    {
+        int quotient = numerator / denominator;
+        return (numerator % denominator != 0 && ((numerator < 0) != (denominator < 0))) ? quotient - 1 : quotient;
+    }
+
+    /*
+    Map a cell of a quadrant, depth rows out and col columns across, to grid coordinates.
+    Quadrants are 0 north, 1 east, 2 south and 3 west.
+    */
+    void toGrid(int quadrant, int depth, int col, int& x, int& y) const
+    {
+        switch (quadrant)
+        {
+        case 0:
+            x = originX + col;
+            y = originY - depth;
+            break;
+        case 1:
+            x = originX + depth;
+            y = originY + col;
+            break;
+        case 2:
+            x = originX + col;
+            y = originY + depth;
+            break;
+        default:
+            x = originX - depth;
+            y = originY + col;
+            break;
+        }
+    }
+
+    /*
+    Check if a cell touches the view cone, treating it as a circle around its center.
+    */
+    bool inCone(int x, int y) const
+    {
+        if (coneHalfAngle >= PI)
+        {
+            return true;
+        }
+        double relativeX = x - originX;
+        double relativeY = y - originY;
+        double distance = std::sqrt(relativeX * relativeX + relativeY * relativeY);
+        if (distance < 1.0)
+        {
+            return true;
+        }
+        double angle = std::abs(std::remainder(std::atan2(relativeY, relativeX) - coneAngle, 2 * PI));
+        //0.75 cells covers the corners of the cell and the character standing anywhere in its own cell
+        return angle - std::asin(std::min(0.75 / distance, 1.0)) <= coneHalfAngle;
+    }
+
+    void reveal(int x, int y)
+    {
+        if (grid.contains(x, y) && inCone(x, y))
+        {
+            std::uint64_t bit = std::uint64_t(1) << (x & 63);
+            visible[size_t(y) * wordsPerRow + (x >> 6)] |= bit;
+            explored[size_t(y) * wordsPerRow + (x >> 6)] |= bit;
+        }
+    }
+
+    /*
+    Shadowcast one quadrant. Rows are handled from a stack instead of recursing, so large maps cannot overflow the call stack.
+    */
+    void castQuadrant(int quadrant)
+    {
+        pending.clear();
+        pending.push_back(scanRow{ 1, -1, 1, 1, 1 });
+        while (!pending.empty())
+        {
+            scanRow row = pending.back();
+            pending.pop_back();
+
+            //columns whose centers round into the slope range, ties rounded inwards
+            int minCol = floorDivide(2 * row.depth * row.startNumerator + row.startDenominator, 2 * row.startDenominator);
+            int maxCol = -floorDivide(-(2 * row.depth * row.endNumerator - row.endDenominator), 2 * row.endDenominator);
+            //rows leaving the grid on every side can see nothing more
+            int firstX, firstY, lastX, lastY;
+            toGrid(quadrant, row.depth, minCol, firstX, firstY);
+            toGrid(quadrant, row.depth, maxCol, lastX, lastY);
+            if (std::max(firstX, lastX) < 0 || std::min(firstX, lastX) >= width || std::max(firstY, lastY) < 0 || std::min(firstY, lastY) >= height)
+            {
+                continue;
+            }
+
+            int previous = -1;
+            for (int col = minCol; col <= maxCol; ++col)
+            {
+                int x, y;
+                toGrid(quadrant, row.depth, col, x, y);
+                int wall = grid.blocksSight(x, y) ? 1 : 0;
+                //floor cells need their center inside the range to be seen, walls are seen if any of them is
+                bool symmetric = col * row.startDenominator >= row.depth * row.startNumerator && col * row.endDenominator <= row.depth * row.endNumerator;
+                if (wall || symmetric)
+                {
+                    reveal(x, y);
+                }
+                if (previous == 1 && !wall)
+                {
+                    row.startNumerator = 2 * col - 1;
+                    row.startDenominator = 2 * row.depth;
+                }
+                if (previous == 0 && wall)
+                {
+                    pending.push_back(scanRow{ row.depth + 1, row.startNumerator, row.startDenominator, 2 * col - 1, 2 * row.depth });
+                }
+                previous = wall;
+            }
+            if (previous == 0)
+            {
+                pending.push_back(scanRow{ row.depth + 1, row.startNumerator, row.startDenominator, row.endNumerator, row.endDenominator });
+            }
+        }
+    }
+
+public:
+
+    /*
+    Params:
+        grid - map to see. Must outlive the field of view, call invalidate after changing its cells.
+    */
+    explicit FieldOfView(const WorldGrid& grid) :
+        grid(grid), width(grid.getWidth()), height(grid.getHeight()), wordsPerRow((grid.getWidth() + 63) / 64),
+        visible(size_t(wordsPerRow) * height, 0), explored(size_t(wordsPerRow) * height, 0)
+    {
+    }
+
+    /*
+    Recompute the visible cells if the character changed cell, heading bucket or projection since the last update.
+
+    Params:
+        character - viewer, its center is the origin and its field of view the cone.
+    Returns:
+        True if the visible set was recomputed.
+    */
+    bool update(Character& character)
+    {
+        sf::Vector2f center = character.getCenter();
+        sf::Vector2<double> dir = character.getDirectionVector();
+        int cellX = int(std::floor(center.x / BLOCK_WIDTH));
+        int cellY = int(std::floor(center.y / BLOCK_WIDTH));
+        double bucketWidth = 2 * PI / HEADING_BUCKETS;
+        int bucket = int(std::floor((std::atan2(dir.y, dir.x) + PI) / bucketWidth)) % HEADING_BUCKETS;
+        if (!dirty && &character == viewer && cellX == originX && cellY == originY && bucket == headingBucket && character.getProjection() == projection)
+        {
+            return false;
+        }
+        viewer = &character;
+        originX = cellX;
+        originY = cellY;
+        headingBucket = bucket;
+        projection = character.getProjection();
+        dirty = false;
+
+        sf::Vector2<double> plane = character.getCameraPlaneVector();
+        coneAngle = (bucket + 0.5) * bucketWidth - PI;
+        coneHalfAngle = projection == PROJECTION_PANORAMIC ? PI :
+            std::atan2(std::sqrt(plane.x * plane.x + plane.y * plane.y), std::sqrt(dir.x * dir.x + dir.y * dir.y)) + bucketWidth / 2;
+
+        std::fill(visible.begin(), visible.end(), std::uint64_t(0));
+        reveal(originX, originY);
+        for (int quadrant = 0; quadrant < 4; ++quadrant)
+        {
+            castQuadrant(quadrant);
+        }
+        return true;
+    }
+
+    /*
+    Force the next update to recompute, e.g. after the grid changed.
+    */
+    void invalidate()
+    {
+        dirty = true;
+    }
+
+    /*
+    Forget every explored cell.
+    */
+    void resetExplored()
+    {
+        std::fill(explored.begin(), explored.end(), std::uint64_t(0));
+        dirty = true;
+    }
+
+    /*
+    Check if a cell is visible to the character the last update was for. Cells outside the grid are not.
+    */
+    bool isVisible(int x, int y) const
+    {
+        return grid.contains(x, y) && (visible[size_t(y) * wordsPerRow + (x >> 6)] >> (x & 63)) & 1;
+    }
+
+    /*
+    Check if a cell was visible in any update so far.
+    */
+    bool isExplored(int x, int y) const
+    {
+        return grid.contains(x, y) && (explored[size_t(y) * wordsPerRow + (x >> 6)] >> (x & 63)) & 1;
+    }
+
+    /*
+    Returns:
+        Character the visible set was last computed for, nullptr before the first update.
+    */
+    const Character* getViewer() const
+    {
+        return viewer;
+    }
+};
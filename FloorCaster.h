@@ -0,0 +1,338 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#include "CellIndexing.h"
+#include "Character.h"
+#include "FrameBuffer.h"
+#include "WorkerPool.h"
+
+//floor and ceiling textures have one texel per world pixel, so a cell maps onto exactly one texture
+static constexpr int SURFACE_TEXTURE_SIZE = BLOCK_PIXELS;
+using SurfaceIndexing = CellIndexing<SURFACE_TEXTURE_SIZE>;
+//material 0 means no surface and is drawn black
+static constexpr int SURFACE_MATERIAL_COUNT = 4;
+
+/*
+Draws textured floor and ceiling into the 3D view.
+
+Horizontal planes are cast one screen row at a time: every pixel in a row is at the same distance from the camera,
+so a row only needs its start position in the world and a constant step per column. Rows are independent and split across the worker pool.
+The angular projections of Character look along a different ray in each column, so their rows use the character's table of ray directions instead.
+The floor row and its mirrored ceiling row share the same world positions and are filled together.
+*/
+class FloorCaster
+{
+
+private:
+
+    //map dimensions in cells
+    int layerWidth;
+    int layerHeight;
+
+    //material of each cell stored row by row
+    std::vector<int> floorLayer;
+    std::vector<int> ceilingLayer;
+
+    //SURFACE_MATERIAL_COUNT textures stored one after another, each SURFACE_TEXTURE_SIZE squared packed RGBA texels
+    std::vector<std::uint32_t> texels;
+
+    /*
+    Convert a 2D material layer into a flat row major vector. Unknown materials are treated as no surface.
+
+    Params:
+        layer - 2D vector of materials as read from the map files.
+    Returns:
+        Flat vector of layerWidth * layerHeight materials.
+    */
+    std::vector<int> flattenLayer(const std::vector<std::vector<int>>& layer)
+    {
+        std::vector<int> flat(size_t(layerWidth) * layerHeight, 0);
+        for (int y = 0; y < layerHeight && y < int(layer.size()); ++y)
+        {
+            for (int x = 0; x < layerWidth && x < int(layer[y].size()); ++x)
+            {
+                int material = layer[y][x];
+                flat[size_t(y) * layerWidth + x] = (material > 0 && material < SURFACE_MATERIAL_COUNT) ? material : 0;
+            }
+        }
+        return flat;
+    }
+
+    /*
+    Generate the surface textures: 1 is a stone checkerboard, 2 wooden planks and 3 tiles.
+    */
+    void generateTextures()
+    {
+        texels.assign(size_t(SURFACE_MATERIAL_COUNT) * SURFACE_TEXTURE_SIZE * SURFACE_TEXTURE_SIZE, packColor(0, 0, 0));
+        for (int y = 0; y < SURFACE_TEXTURE_SIZE; ++y)
+        {
+            for (int x = 0; x < SURFACE_TEXTURE_SIZE; ++x)
+            {
+                size_t texel = size_t(y) * SURFACE_TEXTURE_SIZE + x;
+                size_t textureSize = size_t(SURFACE_TEXTURE_SIZE) * SURFACE_TEXTURE_SIZE;
+
+                bool darkSquare = ((x >> 3) ^ (y >> 3)) & 1;
+                texels[1 * textureSize + texel] = darkSquare ? packColor(70, 70, 70) : packColor(95, 95, 95);
+
+                bool plankSeam = (y % 8) == 0 || ((x + (y / 8) * 11) % SURFACE_TEXTURE_SIZE) == 0;
+                texels[2 * textureSize + texel] = plankSeam ? packColor(70, 45, 20) : packColor(115, 75, 40);
+
+                bool grout = (x % 16) == 0 || (y % 16) == 0;
+                texels[3 * textureSize + texel] = grout ? packColor(40, 40, 50) : packColor(65, 75, 105);
+            }
+        }
+    }
+
+#if defined(__AVX2__)
+    /*
+    Look up the floor and ceiling texels of 8 world positions: gather cell materials, then gather texels.
+    Positions outside the map use material 0.
+    */
+    void shadePacket(__m256 worldX, __m256 worldY, std::uint32_t* floorPixels, std::uint32_t* ceilingPixels) const
+    {
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256i rowStride = _mm256_set1_epi32(layerWidth);
+        const int* texelBase = reinterpret_cast<const int*>(texels.data());
+
+        __m256 inside = _mm256_and_ps(
+            _mm256_and_ps(_mm256_cmp_ps(worldX, zero, _CMP_GE_OQ), _mm256_cmp_ps(worldX, _mm256_set1_ps(float(layerWidth * SURFACE_TEXTURE_SIZE)), _CMP_LT_OQ)),
+            _mm256_and_ps(_mm256_cmp_ps(worldY, zero, _CMP_GE_OQ), _mm256_cmp_ps(worldY, _mm256_set1_ps(float(layerHeight * SURFACE_TEXTURE_SIZE)), _CMP_LT_OQ)));
+        __m256i insideMask = _mm256_castps_si256(inside);
+
+        __m256i pixelX = _mm256_cvttps_epi32(worldX);
+        __m256i pixelY = _mm256_cvttps_epi32(worldY);
+        __m256i cellX = SurfaceIndexing::cell(pixelX);
+        __m256i cellY = SurfaceIndexing::cell(pixelY);
+        __m256i cell = _mm256_add_epi32(_mm256_mullo_epi32(cellY, rowStride), cellX);
+        //lanes outside the map can have negative offsets, they use the first texel like shadePixel
+        __m256i texel = _mm256_and_si256(SurfaceIndexing::texel(SurfaceIndexing::offset(pixelX, cellX), SurfaceIndexing::offset(pixelY, cellY)), insideMask);
+
+        //lanes outside the map keep material 0 and never touch the layers
+        __m256i floorMaterial = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), floorLayer.data(), cell, insideMask, 4);
+        __m256i ceilingMaterial = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), ceilingLayer.data(), cell, insideMask, 4);
+
+        __m256i floorTexel = _mm256_add_epi32(SurfaceIndexing::texture(floorMaterial), texel);
+        __m256i ceilingTexel = _mm256_add_epi32(SurfaceIndexing::texture(ceilingMaterial), texel);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(floorPixels), _mm256_i32gather_epi32(texelBase, floorTexel, 4));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(ceilingPixels), _mm256_i32gather_epi32(texelBase, ceilingTexel, 4));
+    }
+#endif
+
+    /*
+    Look up the floor and ceiling texels of one world position. Positions outside the map use material 0.
+    */
+    void shadePixel(float worldX, float worldY, std::uint32_t& floorPixel, std::uint32_t& ceilingPixel) const
+    {
+        int floorMaterial = 0;
+        int ceilingMaterial = 0;
+        int texel = 0;
+        if (worldX >= 0.f && worldX < float(layerWidth * SURFACE_TEXTURE_SIZE) && worldY >= 0.f && worldY < float(layerHeight * SURFACE_TEXTURE_SIZE))
+        {
+            int pixelX = int(worldX);
+            int pixelY = int(worldY);
+            size_t cell = size_t(SurfaceIndexing::cell(pixelY)) * layerWidth + SurfaceIndexing::cell(pixelX);
+            floorMaterial = floorLayer[cell];
+            ceilingMaterial = ceilingLayer[cell];
+            texel = SurfaceIndexing::offset(pixelY) * SURFACE_TEXTURE_SIZE + SurfaceIndexing::offset(pixelX);
+        }
+        floorPixel = texels[size_t(floorMaterial) * SurfaceIndexing::AREA + texel];
+        ceilingPixel = texels[size_t(ceilingMaterial) * SurfaceIndexing::AREA + texel];
+    }
+
+    /*
+    Fill the floor and ceiling pixels of one row pair of the flat projection, where world positions step evenly along the row.
+
+    Params:
+        floorRow - first pixel of the floor row.
+        ceilingRow - first pixel of the mirrored ceiling row.
+        width - number of pixels in the row.
+        startX, startY - world position seen by the first column.
+        stepX, stepY - world distance between neighbouring columns.
+    */
+    void fillRow(std::uint32_t* floorRow, std::uint32_t* ceilingRow, int width, float startX, float startY, float stepX, float stepY) const
+    {
+        int x = 0;
+#if defined(__AVX2__)
+        const __m256 lanes = _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f);
+        for (; x + 8 <= width; x += 8)
+        {
+            __m256 column = _mm256_add_ps(_mm256_set1_ps(float(x)), lanes);
+            __m256 worldX = _mm256_add_ps(_mm256_set1_ps(startX), _mm256_mul_ps(_mm256_set1_ps(stepX), column));
+            __m256 worldY = _mm256_add_ps(_mm256_set1_ps(startY), _mm256_mul_ps(_mm256_set1_ps(stepY), column));
+            shadePacket(worldX, worldY, floorRow + x, ceilingRow + x);
+        }
+#endif
+        for (; x < width; ++x)
+        {
+            shadePixel(startX + stepX * float(x), startY + stepY * float(x), floorRow[x], ceilingRow[x]);
+        }
+    }
+
+    /*
+    Fill the floor and ceiling pixels of one row pair of an angular projection, where each column looks along its own ray.
+
+    Params:
+        floorRow - first pixel of the floor row.
+        ceilingRow - first pixel of the mirrored ceiling row.
+        width - number of pixels in the row.
+        originX, originY - camera position.
+        distance - distance along every ray to the floor seen by this row.
+        dirX, dirY - unit ray direction of each column.
+    */
+    void fillRowTable(std::uint32_t* floorRow, std::uint32_t* ceilingRow, int width, float originX, float originY, float distance, const float* dirX, const float* dirY) const
+    {
+        int x = 0;
+#if defined(__AVX2__)
+        for (; x + 8 <= width; x += 8)
+        {
+            __m256 worldX = _mm256_add_ps(_mm256_set1_ps(originX), _mm256_mul_ps(_mm256_set1_ps(distance), _mm256_loadu_ps(dirX + x)));
+            __m256 worldY = _mm256_add_ps(_mm256_set1_ps(originY), _mm256_mul_ps(_mm256_set1_ps(distance), _mm256_loadu_ps(dirY + x)));
+            shadePacket(worldX, worldY, floorRow + x, ceilingRow + x);
+        }
+#endif
+        for (; x < width; ++x)
+        {
+            shadePixel(originX + distance * dirX[x], originY + distance * dirY[x], floorRow[x], ceilingRow[x]);
+        }
+    }
+
+public:
+
+    /*
+    Params:
+        floorMap - 2D vector of floor materials, one per map cell.
+        ceilingMap - 2D vector of ceiling materials, one per map cell.
+    */
+    FloorCaster(const std::vector<std::vector<int>>& floorMap, const std::vector<std::vector<int>>& ceilingMap) :
+        layerWidth(WORLD_BLOCK_WIDTH), layerHeight(WORLD_BLOCK_HEIGHT)
+    {
+        floorLayer = flattenLayer(floorMap);
+        ceilingLayer = flattenLayer(ceilingMap);
+        generateTextures();
+    }
+
+    //Camera and frame buffer region a set of floor rows is cast for, see prepareView
+    struct floorView
+    {
+        double centerX;
+        double centerY;
+        //rays through the leftmost and rightmost column with unit length direction
+        double leftRayX;
+        double leftRayY;
+        double rightRayX;
+        double rightRayY;
+        //unit ray direction of each column for the angular projections, null for the flat projection
+        const float* unitDirX;
+        const float* unitDirY;
+        //region of the frame buffer the view covers
+        int left;
+        int top;
+        int width;
+        int height;
+    };
+
+    /*
+    Work out the rays a view's floor rows are cast along. For the angular projections this builds the character's
+    ray table for the view width, so the table must not be rebuilt for another width until the rows are cast.
+
+    Params:
+        character - camera position, direction and camera plane.
+        left, top - top left pixel of the view in the frame buffer.
+        width, height - size of the view in pixels.
+    */
+    floorView prepareView(Character& character, int left, int top, int width, int height) const
+    {
+        //rays are scaled so the direction has unit length. Distances along them then match the distances used for wall heights.
+        sf::Vector2f center = character.getCenter();
+        sf::Vector2<double> dir = character.getDirectionVector();
+        sf::Vector2<double> plane = character.getCameraPlaneVector();
+        double dirLength = std::sqrt(dir.x * dir.x + dir.y * dir.y);
+
+        floorView view;
+        view.centerX = center.x;
+        view.centerY = center.y;
+        view.leftRayX = (dir.x - plane.x) / dirLength;
+        view.leftRayY = (dir.y - plane.y) / dirLength;
+        view.rightRayX = (dir.x + plane.x) / dirLength;
+        view.rightRayY = (dir.y + plane.y) / dirLength;
+        view.unitDirX = nullptr;
+        view.unitDirY = nullptr;
+        if (character.getProjection() != PROJECTION_FLAT)
+        {
+            character.updateRayTable(width);
+            view.unitDirX = character.getUnitRayX().data();
+            view.unitDirY = character.getUnitRayY().data();
+        }
+        view.left = left;
+        view.top = top;
+        view.width = width;
+        view.height = height;
+        return view;
+    }
+
+    /*
+    Returns:
+        Number of floor rows of a view, each filled together with its mirrored ceiling row.
+    */
+    static int countRows(const floorView& view)
+    {
+        return view.height - view.height / 2;
+    }
+
+    /*
+    Fill one floor row below the horizon of a view and the ceiling row mirrored above it.
+
+    Params:
+        frameBuffer - buffer to draw in.
+        view - camera and region, see prepareView.
+        rowOffset - rows below the horizon, 0 to countRows(view) - 1.
+    */
+    void castRow(FrameBuffer& frameBuffer, const floorView& view, int rowOffset) const
+    {
+        int y = view.height / 2 + rowOffset;
+
+        //distance to the floor seen by this row. Uses the same projection as walls: height on screen = screenHeight * BLOCK_WIDTH / distance.
+        double rowDistance = view.height * BLOCK_WIDTH / (2.0 * (rowOffset + 0.5));
+        std::uint32_t* floorRow = frameBuffer.row(view.top + y) + view.left;
+        std::uint32_t* ceilingRow = frameBuffer.row(view.top + view.height - 1 - y) + view.left;
+        if (view.unitDirX)
+        {
+            fillRowTable(floorRow, ceilingRow, view.width, float(view.centerX), float(view.centerY), float(rowDistance), view.unitDirX, view.unitDirY);
+            return;
+        }
+
+        float startX = float(view.centerX + rowDistance * view.leftRayX);
+        float startY = float(view.centerY + rowDistance * view.leftRayY);
+        float stepX = float(rowDistance * (view.rightRayX - view.leftRayX) / view.width);
+        float stepY = float(rowDistance * (view.rightRayY - view.leftRayY) / view.width);
+
+        fillRow(floorRow, ceilingRow, view.width, startX, startY, stepX, stepY);
+    }
+
+    /*
+    Draw floor into the bottom half and ceiling into the top half of the frame buffer.
+    Walls are drawn on top afterwards, so rows are filled completely.
+
+    Params:
+        frameBuffer - buffer to draw in.
+        character - camera position, direction and camera plane.
+        pool - workers the rows are split across.
+    */
+    void castRows(FrameBuffer& frameBuffer, Character& character, WorkerPool& pool)
+    {
+        floorView view = prepareView(character, 0, 0, frameBuffer.getWidth(), frameBuffer.getHeight());
+        pool.parallelFor(countRows(view), 16, [&](int begin, int end)
+        {
+            for (int rowOffset = begin; rowOffset < end; ++rowOffset)
+            {
+                castRow(frameBuffer, view, rowOffset);
+            }
+        });
+    }
+};
@@ -0,0 +1,511 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "WorldGrid.h"
+
+/*
+Distance to a goal from every cell and the step to take from each cell, for steering any number of agents to one goal.
+
+Moves follow the same rules as PathFinder: 8 connected, and diagonal steps need both cells beside them empty. Distances
+are integers, STRAIGHT_COST per straight step and DIAGONAL_COST per diagonal one.
+
+Fields are built and kept up to date by a FlowFieldCache.
+*/
+class FlowField
+{
+
+public:
+
+    static constexpr std::uint32_t STRAIGHT_COST = 5;
+    static constexpr std::uint32_t DIAGONAL_COST = 7;
+    static constexpr std::uint32_t UNREACHABLE = 0xFFFFFFFF;
+    //direction of walls, unreachable cells and the goal itself
+    static constexpr std::uint8_t NO_DIRECTION = 8;
+
+    //steps in direction order, clockwise from east. Even directions are straight, odd ones diagonal.
+    static constexpr int STEP_X[8] = { 1, 1, 0, -1, -1, -1, 0, 1 };
+    static constexpr int STEP_Y[8] = { 0, 1, 1, 1, 0, -1, -1, -1 };
+
+private:
+
+    friend class FlowFieldCache;
+
+    int width;
+    int height;
+    int goalX;
+    int goalY;
+    //useCount of the cache when the field was last asked for, 0 for a free slot
+    std::uint64_t lastUsed;
+
+    std::vector<std::uint32_t> distance;
+    std::vector<std::uint8_t> direction;
+
+public:
+
+    /*
+    Get the direction to move in from a cell. Coordinates outside the grid have no direction.
+
+    Params:
+        x - cell column.
+        y - cell row.
+    Returns:
+        0-7 as in STEP_X and STEP_Y, or NO_DIRECTION.
+    */
+    std::uint8_t getDirection(int x, int y) const
+    {
+        if (x < 0 || y < 0 || x >= width || y >= height)
+        {
+            return NO_DIRECTION;
+        }
+        return direction[size_t(y) * width + x];
+    }
+
+    /*
+    Get the unit vector to move along from a cell.
+
+    Params:
+        x - cell column.
+        y - cell row.
+        dirX, dirY - set to the direction, or to 0 if the cell has none.
+    Returns:
+        False at the goal and on cells that cannot reach it.
+    */
+    bool getDirection(int x, int y, float& dirX, float& dirY) const
+    {
+        static constexpr float DIAGONAL = 0.70710678f;
+        std::uint8_t step = getDirection(x, y);
+        if (step == NO_DIRECTION)
+        {
+            dirX = 0.f;
+            dirY = 0.f;
+            return false;
+        }
+        float scale = step & 1 ? DIAGONAL : 1.f;
+        dirX = STEP_X[step] * scale;
+        dirY = STEP_Y[step] * scale;
+        return true;
+    }
+
+    /*
+    Get the distance from a cell to the goal.
+
+    Returns:
+        Distance in STRAIGHT_COST units per cell, UNREACHABLE for walls, cells outside the grid and cells cut off from the goal.
+    */
+    std::uint32_t getDistance(int x, int y) const
+    {
+        if (x < 0 || y < 0 || x >= width || y >= height)
+        {
+            return UNREACHABLE;
+        }
+        return distance[size_t(y) * width + x];
+    }
+
+    int getGoalX() const
+    {
+        return goalX;
+    }
+
+    int getGoalY() const
+    {
+        return goalY;
+    }
+};
+
+/*
+Builds flow fields for goals on a WorldGrid and keeps the most recently used ones.
+
+A field is built once with Dijkstra's algorithm over a bucket queue: step costs are at most DIAGONAL_COST, so
+DIAGONAL_COST + 1 buckets indexed by distance modulo their count keep the queue sorted without a heap.
+
+When a cell changes, cached fields are repaired instead of rebuilt. An opened cell can only shorten distances, so the
+search is restarted from its neighbours and only touches cells that get closer. A new wall can only lengthen them:
+the cells whose steps lead through it, or diagonally past its corner, are found by following the direction field backwards,
+cleared, and filled in again from the cells around them.
+*/
+class FlowFieldCache
+{
+
+private:
+
+    static constexpr int MAX_FIELDS = 8;
+    static constexpr int BUCKET_COUNT = FlowField::DIAGONAL_COST + 1;
+
+    const WorldGrid& grid;
+    std::vector<FlowField> fields;
+    std::uint64_t useCount{ 0 };
+
+    //search state shared by every build and repair
+    std::vector<int> buckets[BUCKET_COUNT];
+    std::vector<int> seeds;
+    std::vector<int> changed;
+    std::vector<int> invalid;
+
+    static std::uint32_t stepCost(int step)
+    {
+        return step & 1 ? FlowField::DIAGONAL_COST : FlowField::STRAIGHT_COST;
+    }
+
+    //one bit per direction a cell can step in, 0 for walls
+    int width;
+    std::vector<std::uint8_t> moves;
+
+    /*
+    Work out the steps from a cell that stay on empty cells without cutting a corner.
+    */
+    std::uint8_t findMoves(int x, int y) const
+    {
+        if (grid.isSolid(x, y))
+        {
+            return 0;
+        }
+        std::uint8_t result = 0;
+        for (int step = 0; step < 8; ++step)
+        {
+            int nextX = x + FlowField::STEP_X[step];
+            int nextY = y + FlowField::STEP_Y[step];
+            if (!grid.isSolid(nextX, nextY) && (!(step & 1) || (!grid.isSolid(nextX, y) && !grid.isSolid(x, nextY))))
+            {
+                result |= std::uint8_t(1 << step);
+            }
+        }
+        return result;
+    }
+
+    bool canStep(int x, int y, int step) const
+    {
+        return (moves[size_t(y) * width + x] >> step) & 1;
+    }
+
+    /*
+    Run Dijkstra's algorithm from the cells in seeds, lowering distances and noting every cell lowered in changed.
+    Seeds can be any distance apart, so they are sorted and only moved into the buckets once the search reaches them.
+    */
+    void propagate(FlowField& field)
+    {
+        std::sort(seeds.begin(), seeds.end(), [&](int a, int b) { return field.distance[a] < field.distance[b]; });
+        size_t nextSeed = 0;
+        size_t pending = 0;
+        std::uint32_t current = 0;
+        while (pending > 0 || nextSeed < seeds.size())
+        {
+            if (pending == 0)
+            {
+                current = std::max(current, field.distance[seeds[nextSeed]]);
+            }
+            //seeds the search lowered already are in the buckets, moving them again is harmless
+            while (nextSeed < seeds.size() && field.distance[seeds[nextSeed]] <= current)
+            {
+                buckets[current % BUCKET_COUNT].push_back(seeds[nextSeed]);
+                ++nextSeed;
+                ++pending;
+            }
+
+            std::vector<int>& bucket = buckets[current % BUCKET_COUNT];
+            //cells pushed while the bucket is processed land in other buckets, as every step costs less than BUCKET_COUNT
+            for (size_t i = 0; i < bucket.size(); ++i)
+            {
+                int cell = bucket[i];
+                //skip cells lowered again since they were pushed
+                if (field.distance[cell] != current)
+                {
+                    continue;
+                }
+                int x = cell % field.width;
+                int y = cell / field.width;
+                for (int step = 0; step < 8; ++step)
+                {
+                    if (!canStep(x, y, step))
+                    {
+                        continue;
+                    }
+                    int next = cell + FlowField::STEP_Y[step] * field.width + FlowField::STEP_X[step];
+                    std::uint32_t nextDistance = current + stepCost(step);
+                    if (nextDistance < field.distance[next])
+                    {
+                        field.distance[next] = nextDistance;
+                        buckets[nextDistance % BUCKET_COUNT].push_back(next);
+                        changed.push_back(next);
+                        ++pending;
+                    }
+                }
+            }
+            pending -= bucket.size();
+            bucket.clear();
+            ++current;
+        }
+        seeds.clear();
+    }
+
+    /*
+    Point a cell at its neighbour closest to the goal.
+    */
+    void updateDirection(FlowField& field, int cell) const
+    {
+        int x = cell % field.width;
+        int y = cell / field.width;
+        std::uint8_t best = FlowField::NO_DIRECTION;
+        if (field.distance[cell] != 0 && field.distance[cell] != FlowField::UNREACHABLE)
+        {
+            std::uint32_t bestDistance = FlowField::UNREACHABLE;
+            for (int step = 0; step < 8; ++step)
+            {
+                if (!canStep(x, y, step))
+                {
+                    continue;
+                }
+                std::uint32_t through = field.distance[cell + FlowField::STEP_Y[step] * field.width + FlowField::STEP_X[step]];
+                if (through != FlowField::UNREACHABLE && through + stepCost(step) < bestDistance)
+                {
+                    bestDistance = through + stepCost(step);
+                    best = std::uint8_t(step);
+                }
+            }
+        }
+        field.direction[cell] = best;
+    }
+
+    void build(FlowField& field)
+    {
+        field.width = grid.getWidth();
+        field.height = grid.getHeight();
+        field.distance.assign(size_t(field.width) * field.height, FlowField::UNREACHABLE);
+        field.direction.assign(size_t(field.width) * field.height, FlowField::NO_DIRECTION);
+
+        int goal = field.goalY * field.width + field.goalX;
+        field.distance[goal] = 0;
+        seeds.push_back(goal);
+        changed.clear();
+        propagate(field);
+        for (int cell : changed)
+        {
+            updateDirection(field, cell);
+        }
+    }
+
+    /*
+    Lower distances after a wall at a cell was removed.
+    */
+    void repairOpened(FlowField& field, int x, int y)
+    {
+        //restart from the neighbours: the cell and any diagonal step past its corners may now be shorter routes
+        for (int step = 0; step < 8; ++step)
+        {
+            if (field.getDistance(x + FlowField::STEP_X[step], y + FlowField::STEP_Y[step]) != FlowField::UNREACHABLE)
+            {
+                seeds.push_back((y + FlowField::STEP_Y[step]) * field.width + x + FlowField::STEP_X[step]);
+            }
+        }
+        changed.clear();
+        propagate(field);
+        for (int cell : changed)
+        {
+            updateDirection(field, cell);
+        }
+    }
+
+    /*
+    Raise distances after a wall was placed at a cell.
+    */
+    void repairClosed(FlowField& field, int x, int y)
+    {
+        invalid.clear();
+        auto invalidate = [&](int cell)
+        {
+            if (field.distance[cell] != FlowField::UNREACHABLE)
+            {
+                field.distance[cell] = FlowField::UNREACHABLE;
+                invalid.push_back(cell);
+            }
+        };
+
+        //the wall itself and neighbours whose diagonal step now cuts its corner
+        invalidate(y * width + x);
+        for (int step = 0; step < 8; ++step)
+        {
+            int neighbourX = x + FlowField::STEP_X[step];
+            int neighbourY = y + FlowField::STEP_Y[step];
+            std::uint8_t direction = field.getDirection(neighbourX, neighbourY);
+            if (direction != FlowField::NO_DIRECTION && !canStep(neighbourX, neighbourY, direction))
+            {
+                invalidate(neighbourY * width + neighbourX);
+            }
+        }
+
+        //then everything whose steps lead through the cleared cells
+        for (size_t i = 0; i < invalid.size(); ++i)
+        {
+            int cellX = invalid[i] % width;
+            int cellY = invalid[i] / width;
+            for (int step = 0; step < 8; ++step)
+            {
+                int neighbourX = cellX + FlowField::STEP_X[step];
+                int neighbourY = cellY + FlowField::STEP_Y[step];
+                //a neighbour pointing back at us steps the opposite way
+                if (field.getDirection(neighbourX, neighbourY) == ((step + 4) & 7))
+                {
+                    invalidate(neighbourY * width + neighbourX);
+                }
+            }
+        }
+
+        //fill the cleared cells in from the intact ones around them
+        for (int cell : invalid)
+        {
+            field.direction[cell] = FlowField::NO_DIRECTION;
+            if (grid.isSolid(cell % width, cell / width))
+            {
+                continue;
+            }
+            std::uint32_t best = FlowField::UNREACHABLE;
+            for (int step = 0; step < 8; ++step)
+            {
+                if (!canStep(cell % width, cell / width, step))
+                {
+                    continue;
+                }
+                std::uint32_t through = field.distance[cell + FlowField::STEP_Y[step] * width + FlowField::STEP_X[step]];
+                if (through != FlowField::UNREACHABLE)
+                {
+                    best = std::min(best, through + stepCost(step));
+                }
+            }
+            if (best < field.distance[cell])
+            {
+                field.distance[cell] = best;
+                seeds.push_back(cell);
+            }
+        }
+        changed.clear();
+        propagate(field);
+        for (int cell : invalid)
+        {
+            updateDirection(field, cell);
+        }
+    }
+
+public:
+
+    /*
+    Params:
+        grid - map the fields cover. Must outlive the cache, report changes to its cells with cellChanged and call refresh
+            after replacing them all.
+    */
+    explicit FlowFieldCache(const WorldGrid& grid) :
+        grid(grid)
+    {
+        //fields never move, so pointers handed out stay valid until their slot is reused
+        fields.reserve(MAX_FIELDS);
+        refresh();
+    }
+
+    /*
+    Get the flow field toward a goal, building it if it is not cached. The least recently used field is dropped once
+    MAX_FIELDS are cached.
+
+    Params:
+        goalX - goal cell column.
+        goalY - goal cell row.
+    Returns:
+        Field valid until a later getField reuses its slot, its goal becomes a wall or clear is called. nullptr if the goal
+        is a wall or outside the grid.
+    */
+    const FlowField* getField(int goalX, int goalY)
+    {
+        if (grid.isSolid(goalX, goalY))
+        {
+            return nullptr;
+        }
+        ++useCount;
+        for (FlowField& field : fields)
+        {
+            if (field.lastUsed != 0 && field.goalX == goalX && field.goalY == goalY)
+            {
+                field.lastUsed = useCount;
+                return &field;
+            }
+        }
+
+        FlowField* field;
+        if (int(fields.size()) < MAX_FIELDS)
+        {
+            fields.emplace_back();
+            field = &fields.back();
+        }
+        else
+        {
+            field = &*std::min_element(fields.begin(), fields.end(),
+                [](const FlowField& a, const FlowField& b) { return a.lastUsed < b.lastUsed; });
+        }
+        field->goalX = goalX;
+        field->goalY = goalY;
+        field->lastUsed = useCount;
+        build(*field);
+        return field;
+    }
+
+    /*
+    Repair the cached fields after WorldGrid::setCell changed whether a cell is a wall.
+
+    Params:
+        x - cell column.
+        y - cell row.
+    */
+    void cellChanged(int x, int y)
+    {
+        if (!grid.contains(x, y))
+        {
+            return;
+        }
+        //the steps of the cell and its neighbours may have changed
+        for (int neighbourY = std::max(y - 1, 0); neighbourY <= std::min(y + 1, grid.getHeight() - 1); ++neighbourY)
+        {
+            for (int neighbourX = std::max(x - 1, 0); neighbourX <= std::min(x + 1, width - 1); ++neighbourX)
+            {
+                moves[size_t(neighbourY) * width + neighbourX] = findMoves(neighbourX, neighbourY);
+            }
+        }
+
+        bool solid = grid.isSolid(x, y);
+        for (FlowField& field : fields)
+        {
+            if (field.lastUsed == 0)
+            {
+                continue;
+            }
+            if (solid && field.goalX == x && field.goalY == y)
+            {
+                //goal walled in, free the slot
+                field.lastUsed = 0;
+                field.goalX = -1;
+            }
+            else if (solid)
+            {
+                repairClosed(field, x, y);
+            }
+            else
+            {
+                repairOpened(field, x, y);
+            }
+        }
+    }
+
+    /*
+    Drop every cached field and reread the grid, e.g. after loading another map or restoring a snapshot.
+    */
+    void refresh()
+    {
+        fields.clear();
+        width = grid.getWidth();
+        moves.resize(size_t(width) * grid.getHeight());
+        for (int y = 0; y < grid.getHeight(); ++y)
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                moves[size_t(y) * width + x] = findMoves(x, y);
+            }
+        }
+    }
+};
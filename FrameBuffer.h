@@ -0,0 +1,114 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include <SFML/Graphics/RenderWindow.hpp>
+#include <SFML/Graphics/Texture.hpp>
+#include <SFML/Graphics/Sprite.hpp>
+
+/*
+Pack a color into the RGBA byte order expected by sf::Texture::update. Assumes a little endian host.
+*/
+inline std::uint32_t packColor(std::uint8_t r, std::uint8_t g, std::uint8_t b, std::uint8_t a = 255)
+{
+    return std::uint32_t(r) | (std::uint32_t(g) << 8) | (std::uint32_t(b) << 16) | (std::uint32_t(a) << 24);
+}
+
+/*
+CPU side pixel buffer for the 3D view. Renderers write packed RGBA pixels row by row and
+the whole buffer is uploaded to the GPU with a single texture update per frame.
+
+The width can shrink below the size the buffer was created with, for rendering at a lower horizontal resolution.
+Rows are always stored back to back, so only the pixels in use are uploaded.
+
+The pixels can also live in caller owned memory, e.g. a SharedFrameRing slot, so a frame is rendered straight into it.
+*/
+class FrameBuffer
+{
+
+private:
+
+    int width;
+    int height;
+    int maxWidth;
+    std::vector<std::uint32_t> pixels;
+    //pixels.data() or the storage given to setTarget
+    std::uint32_t* target;
+
+    sf::Texture texture;
+    sf::Sprite sprite;
+
+public:
+
+    FrameBuffer(int width, int height) :
+        width(width), height(height), maxWidth(width), pixels(size_t(width) * height, 0), target(pixels.data())
+    {
+        texture.create(width, height);
+        sprite.setTexture(texture, true);
+    }
+
+    FrameBuffer(const FrameBuffer&) = delete;
+    FrameBuffer& operator=(const FrameBuffer&) = delete;
+
+    /*
+    Set every pixel to opaque black.
+    */
+    void clear()
+    {
+        std::fill(target, target + size_t(width) * height, packColor(0, 0, 0));
+    }
+
+    /*
+    Render into other memory instead of the buffer's own pixels. Pixel contents are undefined afterwards.
+
+    Params:
+        storage - room for the width the buffer was created with times its height, or nullptr for the buffer's own pixels.
+    */
+    void setTarget(std::uint32_t* storage)
+    {
+        target = storage ? storage : pixels.data();
+    }
+
+    /*
+    Change the number of columns in use. Pixel contents are undefined afterwards.
+
+    Params:
+        newWidth - columns per row, clamped to the width the buffer was created with.
+    */
+    void setWidth(int newWidth)
+    {
+        width = std::min(std::max(newWidth, 1), maxWidth);
+        sprite.setTextureRect(sf::IntRect(0, 0, width, height));
+    }
+
+    /*
+    Get pointer to the first pixel of a row.
+
+    Params:
+        y - row index, 0 is the top of the screen.
+    */
+    std::uint32_t* row(int y)
+    {
+        return target + size_t(y) * width;
+    }
+
+    /*
+    Upload pixels to the GPU and draw them covering the top left of the window's view, one pixel per view unit.
+    */
+    void draw(sf::RenderWindow& window)
+    {
+        texture.update(reinterpret_cast<const sf::Uint8*>(target), width, height, 0, 0);
+        window.draw(sprite);
+    }
+
+    int getWidth() const
+    {
+        return width;
+    }
+
+    int getHeight() const
+    {
+        return height;
+    }
+};
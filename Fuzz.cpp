@@ -0,0 +1,32 @@
+#include <cstdint>
+#include <cstdlib>
+#include "RaycastOracle.h"
+
+/*
+Checks every ray kernel against the reference raycaster, see DifferentialFuzzer. Build it as its own executable, apart from the demo.
+
+Usage: fuzz [seed] [cases] [runs]
+    seed - seed of the first run, 1 by default.
+    cases - random cases per run, 2000 by default.
+    runs - runs with consecutive seeds, 40 by default. Cameras standing within a hair of a wall only turn up every few
+        thousand cases, so a sweep shorter than the default can pass with a broken kernel.
+Exits with 1 on the first mismatch, after printing the minimized case.
+
+Build: g++ -std=c++17 -O2 -pthread Fuzz.cpp -o fuzz -lsfml-graphics -lsfml-window -lsfml-system
+*/
+int main(int argc, char** argv)
+{
+    std::uint64_t seed = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1;
+    int cases = argc > 2 ? std::atoi(argv[2]) : 2000;
+    int runs = argc > 3 ? std::atoi(argv[3]) : 40;
+
+    DifferentialFuzzer fuzzer;
+    for (int run = 0; run < runs; ++run)
+    {
+        if (!fuzzer.run(seed + run, cases))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
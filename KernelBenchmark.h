@@ -0,0 +1,201 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include "BatchRaycaster.h"
+#include "Character.h"
+#include "PerfCounters.h"
+#include "WorldGrid.h"
+
+/*
+Times the ray kernels from the character's current pose and reports hardware counters per ray and per DDA step.
+
+Each kernel is run repeatedly for at least MIN_SECONDS with PerfCounters around the timed loop. DDA steps are not
+counted inside the kernels, which would slow them down: a DDA ray crosses one cell boundary per step, so the steps of a
+ray are the cells between the camera's cell and the hit cell along both axes, worked out once from the hit points.
+Kernels that do not step every ray through the grid, the adaptive stride and the face span sweep, are reported per
+cast column only. Counters the system does not provide are shown as n/a.
+*/
+class KernelBenchmark
+{
+
+private:
+
+    static constexpr double MIN_SECONDS = 0.1;
+    static constexpr int MIN_ITERATIONS = 10;
+
+    //rays of the every column run, in cell units, reused by the batch kernel
+    std::vector<float> originX;
+    std::vector<float> originY;
+    std::vector<float> dirX;
+    std::vector<float> dirY;
+    std::vector<float> distance;
+    std::vector<int> material;
+    std::vector<std::uint8_t> face;
+
+    struct measurement
+    {
+        const char* kernel;
+        double rays;
+        double steps;
+        double seconds;
+        double counters[COUNTER_COUNT];
+    };
+
+    /*
+    Run a kernel until enough time has passed and total its counters.
+
+    Params:
+        kernel - name to report.
+        run - casts one batch of rays.
+        rays - rays cast per batch.
+        steps - DDA steps per batch, 0 if the kernel is not reported per step.
+    */
+    template <typename Kernel>
+    measurement measure(const char* kernel, Kernel run, double rays, double steps)
+    {
+        PerfCounters counters;
+        measurement result{ kernel, 0.0, 0.0, 0.0, {} };
+        for (int i = 0; i < 3; ++i)
+        {
+            run();
+        }
+
+        int iterations = 0;
+        auto begin = std::chrono::steady_clock::now();
+        counters.start();
+        do
+        {
+            run();
+            ++iterations;
+            result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        } while (iterations < MIN_ITERATIONS || result.seconds < MIN_SECONDS);
+        counters.stop();
+
+        result.rays = rays * iterations;
+        result.steps = steps * iterations;
+        for (int c = 0; c < COUNTER_COUNT; ++c)
+        {
+            result.counters[c] = counters.get(perfCounter(c));
+        }
+        return result;
+    }
+
+    static void printPer(const measurement& result, double count)
+    {
+        std::printf(" %10.2f", result.seconds * 1e9 / count);
+        for (int c = 0; c < COUNTER_COUNT; ++c)
+        {
+            if (result.counters[c] < 0.0)
+            {
+                std::printf(" %13s", "n/a");
+            }
+            else
+            {
+                std::printf(" %13.3f", result.counters[c] / count);
+            }
+        }
+    }
+
+    static void printHeader(const char* unit)
+    {
+        std::printf("%-22s %10s", unit, "ns");
+        for (int c = 0; c < COUNTER_COUNT; ++c)
+        {
+            std::printf(" %13s", PerfCounters::getName(perfCounter(c)));
+        }
+        std::printf("\n");
+    }
+
+public:
+
+    /*
+    Benchmark the kernels and print a report to stdout. The character's settings are restored afterwards,
+    its hits are left as the last kernel cast them.
+
+    Params:
+        character - camera pose to cast from.
+        grid - map to cast through.
+        raycaster - batch kernel casting through the same grid.
+        columns - pixel columns cast per frame.
+    */
+    void run(Character& character, const WorldGrid& grid, const BatchRaycaster& raycaster, int columns)
+    {
+        CharacterState saved;
+        character.saveState(saved);
+        auto& hits = character.getHits();
+        std::vector<measurement> results;
+
+        //every column cast with DDA, which also gives the rays and step counts for the rest
+        character.setRayEngine(rayEngine::COLUMN_CASTING);
+        character.setAdaptiveStride(1);
+        character.calcRays(hits, columns, grid);
+        sf::Vector2f center = character.getCenter();
+        int startX = int(std::floor(center.x / BLOCK_WIDTH));
+        int startY = int(std::floor(center.y / BLOCK_WIDTH));
+        int rayCount = int(character.getRayCasts().size());
+        originX.assign(rayCount, float(center.x / BLOCK_WIDTH));
+        originY.assign(rayCount, float(center.y / BLOCK_WIDTH));
+        dirX.resize(rayCount);
+        dirY.resize(rayCount);
+        distance.resize(rayCount);
+        material.resize(rayCount);
+        face.resize(rayCount);
+        double steps = 0.0;
+        for (int i = 0; i < rayCount; ++i)
+        {
+            sf::Vector2f hit = character.getRayCasts()[i].position;
+            float x = hit.x - center.x;
+            float y = hit.y - center.y;
+            float length = std::max(std::sqrt(x * x + y * y), 1e-6f);
+            dirX[i] = x / length;
+            dirY[i] = y / length;
+            //nudge the hit point into the wall it is on the face of
+            int endX = int(std::floor((hit.x + dirX[i] * 0.01f) / BLOCK_WIDTH));
+            int endY = int(std::floor((hit.y + dirY[i] * 0.01f) / BLOCK_WIDTH));
+            steps += std::abs(endX - startX) + std::abs(endY - startY);
+        }
+
+        results.push_back(measure("column casting", [&] { character.calcRays(hits, columns, grid); }, rayCount, steps));
+#if defined(__AVX2__)
+        const char* batchName = "batch AVX2";
+#else
+        const char* batchName = "batch scalar";
+#endif
+        results.push_back(measure(batchName, [&]
+        {
+            raycaster.castRays(originX.data(), originY.data(), dirX.data(), dirY.data(), rayCount, distance.data(), material.data(), face.data());
+        }, rayCount, steps));
+
+        character.setAdaptiveStride(saved.adaptiveStride);
+        character.calcRays(hits, columns, grid);
+        results.push_back(measure("adaptive stride", [&] { character.calcRays(hits, columns, grid); }, character.getCastCount(), 0.0));
+        character.setRayEngine(rayEngine::FACE_SPANS);
+        character.calcRays(hits, columns, grid);
+        results.push_back(measure("face spans", [&] { character.calcRays(hits, columns, grid); }, std::max(character.getCastCount(), 1), 0.0));
+        character.restoreState(saved);
+
+        std::printf("\nKernel benchmark, %d columns, %.1f DDA steps per ray\n", columns, steps / rayCount);
+        printHeader("per ray");
+        for (const auto& result : results)
+        {
+            std::printf("%-22s", result.kernel);
+            printPer(result, result.rays);
+            std::printf("\n");
+        }
+        printHeader("per DDA step");
+        for (const auto& result : results)
+        {
+            if (result.steps > 0.0)
+            {
+                std::printf("%-22s", result.kernel);
+                printPer(result, result.steps);
+                std::printf("\n");
+            }
+        }
+    }
+};
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include "Character.h"
+#include "WorkerPool.h"
+#include "WorldGrid.h"
+
+/*
+Point to point visibility queries against a WorldGrid, for AI perception and audio occlusion.
+
+A query walks the cells under the segment with DDA and stops at the first solid cell. The grid's clearance field is used
+to skip ahead: every cell inside the clearance square around the current cell is empty, so the segment can jump to where
+it leaves that square, and if the end point is inside the square the query is answered without walking any further.
+*/
+class LineOfSight
+{
+
+private:
+
+    static constexpr int QUERIES_PER_CHUNK = 1024;
+
+    const WorldGrid& grid;
+
+public:
+
+    /*
+    Params:
+        grid - map to test against. Must outlive the query object.
+    */
+    explicit LineOfSight(const WorldGrid& grid) :
+        grid(grid)
+    {
+    }
+
+    /*
+    Check if the segment between two points crosses no solid cell. The cells containing the end points count too,
+    so a point inside a wall is never visible.
+
+    Params:
+        fromX, fromY - start point in world pixels.
+        toX, toY - end point in world pixels.
+    Returns:
+        True if nothing blocks the segment.
+    */
+    bool isVisible(float fromX, float fromY, float toX, float toY) const
+    {
+        const float startX = fromX / float(BLOCK_WIDTH);
+        const float startY = fromY / float(BLOCK_WIDTH);
+        const float dx = toX / float(BLOCK_WIDTH) - startX;
+        const float dy = toY / float(BLOCK_WIDTH) - startY;
+        const int targetX = int(std::floor(toX / float(BLOCK_WIDTH)));
+        const int targetY = int(std::floor(toY / float(BLOCK_WIDTH)));
+
+        //t runs from 0 at the start point to 1 at the end point. deltas are how much t grows per cell crossed.
+        const int stepX = dx < 0.f ? -1 : 1;
+        const int stepY = dy < 0.f ? -1 : 1;
+        const float deltaX = (dx == 0.f) ? 1e30f : std::abs(1.f / dx);
+        const float deltaY = (dy == 0.f) ? 1e30f : std::abs(1.f / dy);
+
+        float t = 0.f;
+        int mapX = int(std::floor(startX));
+        int mapY = int(std::floor(startY));
+        float sideX = (dx < 0.f ? startX - mapX : mapX + 1.f - startX) * deltaX;
+        float sideY = (dy < 0.f ? startY - mapY : mapY + 1.f - startY) * deltaY;
+
+        while (t <= 1.f)
+        {
+            if (grid.isSolid(mapX, mapY))
+            {
+                return false;
+            }
+
+            //the rest of the segment lies inside the empty square around this cell
+            int clearance = grid.getClearance(mapX, mapY);
+            if (std::max(std::abs(targetX - mapX), std::abs(targetY - mapY)) < clearance)
+            {
+                return true;
+            }
+
+            if (clearance >= 2)
+            {
+                //jump to where the segment leaves the empty square and restart the DDA from there
+                float exitX = dx > 0.f ? (mapX + clearance - startX) / dx : dx < 0.f ? (mapX - clearance + 1 - startX) / dx : 1e30f;
+                float exitY = dy > 0.f ? (mapY + clearance - startY) / dy : dy < 0.f ? (mapY - clearance + 1 - startY) / dy : 1e30f;
+                t = std::min(exitX, exitY);
+                float pointX = startX + dx * t;
+                float pointY = startY + dy * t;
+                mapX = int(std::floor(pointX));
+                mapY = int(std::floor(pointY));
+                sideX = t + (dx < 0.f ? pointX - mapX : mapX + 1.f - pointX) * deltaX;
+                sideY = t + (dy < 0.f ? pointY - mapY : mapY + 1.f - pointY) * deltaY;
+                continue;
+            }
+
+            if (sideX < sideY)
+            {
+                t = sideX;
+                sideX += deltaX;
+                mapX += stepX;
+            }
+            else
+            {
+                t = sideY;
+                sideY += deltaY;
+                mapY += stepY;
+            }
+        }
+        return true;
+    }
+
+    /*
+    Run many visibility queries split across the worker pool. Query i tests the segment from (fromX[i], fromY[i]) to (toX[i], toY[i]).
+
+    Params:
+        fromX, fromY - start points in world pixels.
+        toX, toY - end points in world pixels.
+        count - number of queries.
+        visible - output, 1 where the segment is unobstructed and 0 otherwise.
+        pool - workers the queries are split across.
+    */
+    void isVisibleBatch(const float* fromX, const float* fromY, const float* toX, const float* toY, int count, std::uint8_t* visible, WorkerPool& pool) const
+    {
+        pool.parallelFor(count, QUERIES_PER_CHUNK, [&](int begin, int end)
+        {
+            for (int i = begin; i < end; ++i)
+            {
+                visible[i] = isVisible(fromX[i], fromY[i], toX[i], toY[i]) ? 1 : 0;
+            }
+        });
+    }
+};
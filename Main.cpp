@@ -1,11 +1,26 @@
 #include <iostream>
+#include <cstdio>
 #include <fstream>
 #include <SFML/Window.hpp>
 #include <SFML/OpenGL.hpp>
 #include <SFML/Graphics/RenderWindow.hpp>
 #include <SFML/Graphics/RectangleShape.hpp>
 #include <SFML/Graphics/CircleShape.hpp>
+#include <SFML/Graphics/View.hpp>
+#include <SFML/System/Clock.hpp>
 #include "Character.h"
+#include "DynamicResolution.h"
+#include "FieldOfView.h"
+#include "FloorCaster.h"
+#include "FrameBuffer.h"
+#include "MirrorReflections.h"
+#include "SharedFrameRing.h"
+#include "SpriteRenderer.h"
+#include "TraceProfiler.h"
+#include "ViewportRenderer.h"
+#include "VisibilityPolygon.h"
+#include "WorkerPool.h"
+#include "WorldGrid.h"
 
 #define screenWidth 640
 #define screenHeight 480
@@ -39,6 +54,30 @@ std::vector<std::vector<int>> readWorldFile(const std::string& source)
     return returnMap;
 }
 
+/*
+Read in csv file of sprites and adds them to the sprite renderer. Each line is the X and Y cell coordinate of the sprite 
+center followed by its type, e.g. 3.5,2.5,1.
+
+Params:
+    source - Path and name of csv file to load.
+    spriteRenderer - renderer to add sprites to.
+*/
+void readSpriteFile(const std::string& source, SpriteRenderer& spriteRenderer)
+{
+    std::fstream stream;
+    stream.open(source, std::ios::in);
+    std::string line;
+    while (getline(stream, line))
+    {
+        float x, y;
+        int type;
+        if (std::sscanf(line.c_str(), "%f,%f,%d", &x, &y, &type) == 3)
+        {
+            spriteRenderer.addSprite(x * BLOCK_WIDTH, y * BLOCK_WIDTH, type);
+        }
+    }
+}
+
 /*
 Generates wall objects and their properties (color and location) and stores them in vector.
 
@@ -70,6 +109,15 @@ std::vector<sf::RectangleShape> generateWalls(std::vector<std::vector<int>>& wor
                 case 3:
                     wall.setFillColor(sf::Color(0, 0, 175)); //blue
                     break;
+                case 4:
+                    wall.setFillColor(sf::Color(140, 200, 230, 120)); //window
+                    break;
+                case 5:
+                    wall.setFillColor(sf::Color(110, 110, 110, 180)); //grate
+                    break;
+                case 6:
+                    wall.setFillColor(sf::Color(150, 160, 170)); //mirror
+                    break;
 
                 }
                 wall.move(BLOCK_WIDTH * j, BLOCK_WIDTH * i);
@@ -116,41 +164,18 @@ Draws 3D window
 
 Params:
     window3D - window to draw in. 
-    character - character object that contains raycasting information to draw screen. 
+    cameras - characters to render, one viewport each. 
+    renderer - draws the viewports.
+    frameBuffer - pixel buffer the whole 3D view is drawn in.
+    pool - worker threads used to split up rendering.
+    columns - number of pixel columns rendered, stretched to the window width.
 */
-void draw3DWindow(sf::RenderWindow& window3D, Character& character)
+void draw3DWindow(sf::RenderWindow& window3D, const std::vector<Character*>& cameras, ViewportRenderer& renderer, FrameBuffer& frameBuffer, WorkerPool& pool, int columns)
 {  
-    //We draw a 1 pixel wide rectangle for each pixel column of the window.
-    //The Rectangle's properties i.e, size and color, are determined by casting a ray from the character, 
-    // through the camera plane at the corresponding angle, and recording how far the ray travels before hitting a wall. 
-    //character.hits is a vector of structs describing each raycast. 
-    for (int i = 0; i < character.getHits().size(); ++i)
-    {
-        //determine how tall the wall should be displayed based on it's distance. 
-        double lineHeight = (1 / character.getHits()[i].distance) * screenHeight * BLOCK_WIDTH;
-
-        //create rectangle 1 pixel wide
-        sf::RectangleShape wall(sf::Vector2f(1.0f, lineHeight));
-
-        //if vertical wall, shade wall to contrast with horizontal wall. 
-        int colorAdjustment = character.getHits()[i].alignment == character.getHits()[i].vertical ? 0 : -25;
-
-        switch (character.getHits()[i].color)
-        {
-        case 1:
-            wall.setFillColor(sf::Color(175 + colorAdjustment, 0, 0));
-            break;
-        case 2:
-            wall.setFillColor(sf::Color(0, 175 + colorAdjustment, 0));
-            break;
-        case 3:
-            wall.setFillColor(sf::Color(0, 0, 175 + colorAdjustment));
-            break;
-        }
-        //move wall so that its center is in the middle of the screen 
-        wall.move(i, (screenHeight / 2) - (lineHeight / 2));
-        window3D.draw(wall);
-    }
+    TRACE_ZONE("draw3DWindow");
+    //each camera gets a share of the columns and rows, so more viewports do not mean more pixels to fill.
+    renderer.layout(cameras, columns, screenHeight);
+    renderer.render(window3D, frameBuffer, pool);
 }
 
 /*
@@ -161,35 +186,33 @@ Params:
     gridlines - lines overlaid on world to more easily see measurments.
     walls - vector of wall objects to draw.
     character - object describing our character in the world. Contains position and raycasting information. 
-    worldMap - 2D vector describing world layout. 
+    visibility - region of the world the character can see. 
+    fieldOfView - cells the character can see and has seen, only explored walls are drawn.
 */
-void draw2DWindow(sf::RenderWindow& window, std::vector<std::array<sf::Vertex, 2>> gridLines, std::vector<sf::RectangleShape> walls, Character& character, std::vector<std::vector<int>>& worldMap)
+void draw2DWindow(sf::RenderWindow& window, std::vector<std::array<sf::Vertex, 2>> gridLines, std::vector<sf::RectangleShape> walls, Character& character, VisibilityPolygon& visibility, FieldOfView& fieldOfView)
 {
+    TRACE_ZONE("draw2DWindow");
     //draw gridlines
     for (const auto line : gridLines)
     {
         window.draw(&line[0], 2, sf::Lines);
     }
-    //draw walls
+    //draw walls the character has seen
+    fieldOfView.update(character);
     for (const auto& wall : walls)
     {
-        window.draw(wall);
+        sf::Vector2f position = wall.getPosition();
+        if (fieldOfView.isExplored(int(position.x / BLOCK_WIDTH), int(position.y / BLOCK_WIDTH)))
+        {
+            window.draw(wall);
+        }
     }
     //draw character
     window.draw(character.getCharObject());
-    
-    //draw rays cast from character
-    character.getRayCasts() = character.calcRays(character.getHits(), screenWidth, worldMap);
-    for (const auto& cast : character.getRayCasts()
-        )
-    {
-        sf::Vertex castingRay[] =
-        {
-            sf::Vertex(sf::Vector2f(character.getCenter().x, character.getCenter().y)),
-            sf::Vertex(cast)
-        };
-        window.draw(castingRay, 2, sf::Lines);
-    }
+
+    //draw the area the rays can reach
+    visibility.update(character);
+    visibility.draw(window);
 }
 
 int main()
@@ -199,6 +222,34 @@ int main()
 
     //read world description file 
     std::vector<std::vector<int>> worldMap = readWorldFile("res/map.csv");
+    WorldGrid grid(worldMap);
+    VisibilityPolygon visibility(grid);
+    FieldOfView fieldOfView(grid);
+
+    //read floor and ceiling materials, one per map cell
+    FloorCaster floorCaster(readWorldFile("res/floor.csv"), readWorldFile("res/ceiling.csv"));
+    FrameBuffer frameBuffer(screenWidth, screenHeight);
+    WorkerPool pool;
+
+    //frames and column hits are rendered straight into shared memory for other processes, see SharedFrameRing.
+    //4 viewports in 2 rows cast at most 2 * screenWidth columns. The demo runs without it if shared memory is unavailable.
+    SharedFrameRing frameRing;
+    frameRing.create("/raycasting_frames", 4, screenWidth, screenHeight, 2 * screenWidth);
+
+    //mirrors cast at most 1024 secondary rays a frame and reflect up to 4 times
+    BatchRaycaster raycaster(grid);
+    MirrorReflections reflections(raycaster, 1024, 4);
+
+
+    //number of columns cast is adjusted every frame to keep raycasting and filling within 8 ms
+    DynamicResolution resolution(8.0f, screenWidth / 4, screenWidth);
+    sf::Clock frameTimer;
+
+    //read sprites placed in the world
+    SpriteRenderer spriteRenderer;
+    readSpriteFile("res/sprites.csv", spriteRenderer);
+    //sprites in cells the character cannot see are skipped for its viewport
+    spriteRenderer.setFieldOfView(&fieldOfView);
     
     //generate walls 
     std::vector<sf::RectangleShape> walls = generateWalls(worldMap);
@@ -213,9 +264,32 @@ int main()
     //create character 
     Character character(16.f, -16, 0, 0, 16, sf::Color(100, 250, 50));
 
+    //fixed observers shown next to the character in split screen, F1, F2 and F4 select 1, 2 or 4 viewports
+    std::vector<Character> observers = 
+    {
+        Character(16.f, 16, 0, 0, -16, sf::Color(250, 200, 50)),
+        Character(16.f, 0, 16, 16, 0, sf::Color(250, 200, 50)),
+        Character(16.f, 0, -16, -16, 0, sf::Color(250, 200, 50))
+    };
+    observers[0].teleport(4.5f * BLOCK_WIDTH, 12.5f * BLOCK_WIDTH);
+    observers[1].teleport(28.5f * BLOCK_WIDTH, 2.5f * BLOCK_WIDTH);
+    observers[2].teleport(20.5f * BLOCK_WIDTH, 13.5f * BLOCK_WIDTH);
+    int viewportCount = 1;
+
+    //F5 saves the character and map, F9 rewinds to the save
+    CharacterState savedCharacter;
+    character.saveState(savedCharacter);
+    GridSnapshot savedGrid;
+    grid.snapshot(savedGrid);
+    ViewportRenderer renderer(grid, floorCaster, spriteRenderer, reflections);
+
+    //F3 writes the zones traced since the last press to trace.json, for Perfetto or chrome://tracing. Debug builds only.
+    TRACE_THREAD("main");
+
     // handle events
     while (window.isOpen())
     {
+        TRACE_ZONE("frame");
         sf::Event event;
         while (window.pollEvent(event))
         {
@@ -247,13 +321,79 @@ int main()
             {
                 character.rotate(movementDirection::RIGHT);
             }
+            else if (sf::Keyboard::isKeyPressed(sf::Keyboard::Num1))
+            {
+                character.setRayEngine(rayEngine::COLUMN_CASTING);
+            }
+            else if (sf::Keyboard::isKeyPressed(sf::Keyboard::Num2))
+            {
+                character.setRayEngine(rayEngine::FACE_SPANS);
+            }
+            else if (sf::Keyboard::isKeyPressed(sf::Keyboard::Num3))
+            {
+                character.setProjection(PROJECTION_FLAT);
+            }
+            else if (sf::Keyboard::isKeyPressed(sf::Keyboard::Num4))
+            {
+                character.setProjection(PROJECTION_CYLINDRICAL);
+            }
+            else if (sf::Keyboard::isKeyPressed(sf::Keyboard::Num5))
+            {
+                character.setProjection(PROJECTION_PANORAMIC);
+            }
+            else if (sf::Keyboard::isKeyPressed(sf::Keyboard::F5))
+            {
+                character.saveState(savedCharacter);
+                grid.snapshot(savedGrid);
+            }
+            else if (sf::Keyboard::isKeyPressed(sf::Keyboard::F9))
+            {
+                character.restoreState(savedCharacter);
+                grid.restore(savedGrid);
+                fieldOfView.invalidate();
+            }
+            else if (sf::Keyboard::isKeyPressed(sf::Keyboard::F1))
+            {
+                viewportCount = 1;
+            }
+            else if (sf::Keyboard::isKeyPressed(sf::Keyboard::F2))
+            {
+                viewportCount = 2;
+            }
+            else if (sf::Keyboard::isKeyPressed(sf::Keyboard::F4))
+            {
+                viewportCount = 4;
+            }
+            else if (sf::Keyboard::isKeyPressed(sf::Keyboard::F3))
+            {
+                TRACE_FLUSH("trace.json");
+            }
         }
 
         window.clear();
         window3D.clear();
 
-        draw2DWindow(window, gridLines, walls, character, worldMap);
-        draw3DWindow(window3D, character);
+        std::vector<Character*> cameras = { &character };
+        for (int i = 0; i + 1 < viewportCount; ++i)
+        {
+            cameras.push_back(&observers[i]);
+        }
+
+        draw2DWindow(window, gridLines, walls, character, visibility, fieldOfView);
+        if (frameRing.isOpen())
+        {
+            SharedFrameRing::writeSlot slot = frameRing.beginFrame();
+            frameBuffer.setTarget(slot.pixels);
+            renderer.setColumnSink(slot.columns, slot.maxColumns);
+        }
+        //only the 3D view's raycasting and filling count against the resolution budget
+        frameTimer.restart();
+        draw3DWindow(window3D, cameras, renderer, frameBuffer, pool, resolution.getColumns());
+        if (frameRing.isOpen())
+        {
+            frameRing.publish(frameBuffer.getWidth(), frameBuffer.getHeight(), renderer.getColumnCount(), int(cameras.size()));
+        }
+        resolution.update(frameTimer.getElapsedTime());
 
         window.display();
         window3D.display();
@@ -0,0 +1,423 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "WorkerPool.h"
+
+//Kind of level MapGenerator builds
+enum mapStyle
+{
+    //perfect maze of one cell wide corridors
+    MAP_MAZE,
+    //organic caves grown with a cellular automaton, not guaranteed to be connected
+    MAP_CAVE,
+    //rectangular rooms on a coarse lattice joined by corridors to their neighbours
+    MAP_ROOMS,
+    //mostly open ground scattered with blocks
+    MAP_OPEN
+};
+
+//Map built by MapGenerator, in the same cell values as res/map.csv.
+struct GeneratedMap
+{
+    int width{ 0 };
+    int height{ 0 };
+    //width * height cells row by row
+    std::vector<int> cells;
+
+    /*
+    Returns:
+        The map as rows, the format readWorldFile returns.
+    */
+    std::vector<std::vector<int>> rows() const
+    {
+        std::vector<std::vector<int>> result(height);
+        for (int y = 0; y < height; ++y)
+        {
+            result[y].assign(cells.begin() + size_t(y) * width, cells.begin() + size_t(y + 1) * width);
+        }
+        return result;
+    }
+};
+
+/*
+Builds seeded levels in memory, for benchmarks that need more than the hand made map and for environment resets.
+
+Every random decision is a hash of the seed and the cell or room it is for rather than a draw from a sequential generator,
+so the work splits into rows across the worker pool and the same seed gives the same map on any number of threads.
+Levels are built as one byte per cell and widened to cell values at the end. Every level has a solid border and walls
+of materials 1 to 3.
+*/
+class MapGenerator
+{
+
+private:
+
+    static constexpr int ROWS_PER_CHUNK = 64;
+    //cave fill ratio and smoothing passes
+    static constexpr std::uint32_t CAVE_FILL = 45;
+    static constexpr int CAVE_PASSES = 4;
+    //side of a room lattice cell and the smallest room
+    static constexpr int ROOM_LATTICE = 24;
+    static constexpr int MIN_ROOM = 4;
+    //side of an open field tile, each of which may hold one block
+    static constexpr int OPEN_TILE = 8;
+    static constexpr std::uint32_t OPEN_BLOCK_CHANCE = 30;
+    //1 in the low bit of every byte of a word
+    static constexpr std::uint64_t LOW_BYTES = 0x0101010101010101ull;
+
+    WorkerPool& pool;
+
+    //1 for wall, 0 for empty. Cave smoothing ping pongs between the two.
+    std::vector<std::uint8_t> solid;
+    std::vector<std::uint8_t> next;
+    //walls in each cell and the cells above and below it, for cave smoothing
+    std::vector<std::uint8_t> columnSums;
+    int width{ 0 };
+    int height{ 0 };
+    std::uint64_t seed{ 0 };
+
+    /*
+    Hash a seed and up to three coordinates into 64 random bits (splitmix64 finalizer).
+    */
+    static std::uint64_t hash(std::uint64_t seed, std::uint64_t a, std::uint64_t b, std::uint64_t c = 0)
+    {
+        std::uint64_t z = seed + a * 0x9E3779B97F4A7C15ull + b * 0xC2B2AE3D27D4EB4Full + c * 0x165667B19E3779F9ull;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    /*
+    Get a random number in [0, range) for a cell or room and a purpose.
+    */
+    std::uint32_t random(std::uint64_t a, std::uint64_t b, std::uint64_t purpose, std::uint32_t range) const
+    {
+        return std::uint32_t((hash(seed, a, b, purpose) >> 32) * range >> 32);
+    }
+
+    std::uint8_t& cell(int x, int y)
+    {
+        return solid[size_t(y) * width + x];
+    }
+
+    /*
+    Run fn(y) for every row in [first, last) across the pool.
+    */
+    template <typename RowFunction>
+    void forRows(int first, int last, int grain, RowFunction fn)
+    {
+        pool.parallelFor(last - first, grain, [&](int begin, int end)
+        {
+            for (int row = begin; row < end; ++row)
+            {
+                fn(first + row);
+            }
+        });
+    }
+
+    /*
+    Set a rectangle of cells, clipped to the inside of the border.
+    */
+    void fillRect(int left, int top, int right, int bottom, std::uint8_t value)
+    {
+        left = std::max(left, 1);
+        top = std::max(top, 1);
+        right = std::min(right, width - 2);
+        bottom = std::min(bottom, height - 2);
+        for (int y = top; y <= bottom; ++y)
+        {
+            std::fill(&cell(left, y), &cell(left, y) + std::max(right - left + 1, 0), value);
+        }
+    }
+
+    /*
+    Sidewinder maze on the odd cells. Maze row j only carves grid rows 2j + 1 and the passages north of it in row 2j,
+    so rows are independent.
+    */
+    void buildMaze()
+    {
+        std::fill(solid.begin(), solid.end(), std::uint8_t(1));
+        int cellsX = (width - 1) / 2;
+        int cellsY = (height - 1) / 2;
+        forRows(0, cellsY, ROWS_PER_CHUNK / 2, [&](int row)
+        {
+            int y = 2 * row + 1;
+            int runStart = 0;
+            std::uint64_t coins = 0;
+            for (int column = 0; column < cellsX; ++column)
+            {
+                int x = 2 * column + 1;
+                cell(x, y) = 0;
+                bool last = column == cellsX - 1;
+                //one hash gives the coin flips of 64 cells
+                if ((column & 63) == 0)
+                {
+                    coins = hash(seed, column, row, 0);
+                }
+                //the top row has nothing to the north, so it is one corridor
+                bool closeRun = row > 0 && (last || ((coins >> (column & 63)) & 1) == 0);
+                if (closeRun)
+                {
+                    int north = runStart + int(random(column, row, 1, std::uint32_t(column - runStart + 1)));
+                    cell(2 * north + 1, y - 1) = 0;
+                    runStart = column + 1;
+                }
+                else if (!last)
+                {
+                    cell(x + 1, y) = 0;
+                }
+            }
+        });
+    }
+
+    /*
+    Load 8 cells as one word, for adding bytes 8 at a time. Cell counts stay far below 128, so bytes never carry into each other.
+    */
+    static std::uint64_t loadBytes(const std::uint8_t* bytes)
+    {
+        std::uint64_t word;
+        std::memcpy(&word, bytes, sizeof(word));
+        return word;
+    }
+
+    static void storeBytes(std::uint8_t* bytes, std::uint64_t word)
+    {
+        std::memcpy(bytes, &word, sizeof(word));
+    }
+
+    /*
+    Random fill, then smoothing passes where a cell becomes wall with 5 or more wall neighbours and stays wall with 4.
+    Every loop works on 8 cells per 64 bit word.
+    */
+    void buildCave()
+    {
+        //a byte of 7 random bits per cell, 8 cells per hash. Adding 128 - threshold sets the top bit of bytes at or over it.
+        const std::uint64_t fillBias = (128 - CAVE_FILL * 128 / 100) * LOW_BYTES;
+        forRows(0, height, ROWS_PER_CHUNK, [&](int y)
+        {
+            std::uint8_t* row = &solid[size_t(y) * width];
+            int x = 0;
+            for (; x + 8 <= width; x += 8)
+            {
+                std::uint64_t bytes = hash(seed, x, y, 0) & (LOW_BYTES * 0x7f);
+                storeBytes(row + x, ~((bytes + fillBias) >> 7) & LOW_BYTES);
+            }
+            std::uint64_t bytes = hash(seed, x, y, 0);
+            for (; x < width; ++x, bytes >>= 8)
+            {
+                row[x] = (bytes & 0x7f) < CAVE_FILL * 128 / 100;
+            }
+            row[0] = row[width - 1] = 1;
+            if (y == 0 || y == height - 1)
+            {
+                std::fill(row, row + width, std::uint8_t(1));
+            }
+        });
+
+        //the 3x3 wall count is summed down the columns first, then along the rows
+        next.resize(solid.size());
+        columnSums.resize(solid.size());
+        for (int pass = 0; pass < CAVE_PASSES; ++pass)
+        {
+            forRows(1, height - 1, ROWS_PER_CHUNK, [&](int y)
+            {
+                const std::uint8_t* above = &solid[size_t(y - 1) * width];
+                const std::uint8_t* here = &solid[size_t(y) * width];
+                const std::uint8_t* below = &solid[size_t(y + 1) * width];
+                std::uint8_t* sums = &columnSums[size_t(y) * width];
+                int x = 0;
+                for (; x + 8 <= width; x += 8)
+                {
+                    storeBytes(sums + x, loadBytes(above + x) + loadBytes(here + x) + loadBytes(below + x));
+                }
+                for (; x < width; ++x)
+                {
+                    sums[x] = std::uint8_t(above[x] + here[x] + below[x]);
+                }
+            });
+            forRows(0, height, ROWS_PER_CHUNK, [&](int y)
+            {
+                std::uint8_t* out = &next[size_t(y) * width];
+                if (y == 0 || y == height - 1)
+                {
+                    std::fill(out, out + width, std::uint8_t(1));
+                    return;
+                }
+                //with the cell itself counted, becoming a wall (5 neighbours) and staying one (4) are both 5 or more in the 3x3 block
+                const std::uint8_t* sums = &columnSums[size_t(y) * width];
+                int x = 1;
+                for (; x + 9 <= width; x += 8)
+                {
+                    std::uint64_t total = loadBytes(sums + x - 1) + loadBytes(sums + x) + loadBytes(sums + x + 1);
+                    storeBytes(out + x, ((total + (128 - 5) * LOW_BYTES) >> 7) & LOW_BYTES);
+                }
+                for (; x < width - 1; ++x)
+                {
+                    out[x] = std::uint8_t(sums[x - 1] + sums[x] + sums[x + 1] >= 5);
+                }
+                out[0] = out[width - 1] = 1;
+            });
+            std::swap(solid, next);
+        }
+    }
+
+    /*
+    One room per lattice cell, joined to the room on its right and the room below with L shaped corridors.
+    Rooms, horizontal links and vertical links are separate passes, and each pass only writes inside one lattice row
+    or column per job, so no two jobs touch the same cells.
+    */
+    void buildRooms()
+    {
+        std::fill(solid.begin(), solid.end(), std::uint8_t(1));
+        int latticeX = std::max((width - 2) / ROOM_LATTICE, 1);
+        int latticeY = std::max((height - 2) / ROOM_LATTICE, 1);
+        int spanX = (width - 2) / latticeX;
+        int spanY = (height - 2) / latticeY;
+
+        //room of a lattice cell: left, top, right, bottom, inclusive
+        auto room = [&](int column, int row, int* bounds)
+        {
+            int roomWidth = std::max(std::min(MIN_ROOM + int(random(column, row, 0, std::uint32_t(std::max(spanX - MIN_ROOM - 1, 1)))), spanX - 2), 1);
+            int roomHeight = std::max(std::min(MIN_ROOM + int(random(column, row, 1, std::uint32_t(std::max(spanY - MIN_ROOM - 1, 1)))), spanY - 2), 1);
+            bounds[0] = 1 + column * spanX + 1 + int(random(column, row, 2, std::uint32_t(std::max(spanX - roomWidth - 1, 1))));
+            bounds[1] = 1 + row * spanY + 1 + int(random(column, row, 3, std::uint32_t(std::max(spanY - roomHeight - 1, 1))));
+            bounds[2] = bounds[0] + roomWidth - 1;
+            bounds[3] = bounds[1] + roomHeight - 1;
+        };
+        auto centerX = [](const int* bounds) { return (bounds[0] + bounds[2]) / 2; };
+        auto centerY = [](const int* bounds) { return (bounds[1] + bounds[3]) / 2; };
+
+        forRows(0, latticeY, 1, [&](int row)
+        {
+            for (int column = 0; column < latticeX; ++column)
+            {
+                int bounds[4];
+                room(column, row, bounds);
+                fillRect(bounds[0], bounds[1], bounds[2], bounds[3], 0);
+            }
+        });
+
+        //to the right: along the row of the first room's center, then up or down inside the second room's lattice column
+        forRows(0, latticeY, 1, [&](int row)
+        {
+            for (int column = 0; column + 1 < latticeX; ++column)
+            {
+                int from[4], to[4];
+                room(column, row, from);
+                room(column + 1, row, to);
+                fillRect(centerX(from), centerY(from), centerX(to), centerY(from), 0);
+                fillRect(centerX(to), std::min(centerY(from), centerY(to)), centerX(to), std::max(centerY(from), centerY(to)), 0);
+            }
+        });
+
+        //downwards: along the column of the first room's center, then across inside the second room's lattice row
+        pool.parallelFor(latticeX, 1, [&](int begin, int end)
+        {
+            for (int column = begin; column < end; ++column)
+            {
+                for (int row = 0; row + 1 < latticeY; ++row)
+                {
+                    int from[4], to[4];
+                    room(column, row, from);
+                    room(column, row + 1, to);
+                    fillRect(centerX(from), centerY(from), centerX(from), centerY(to), 0);
+                    fillRect(std::min(centerX(from), centerX(to)), centerY(to), std::max(centerX(from), centerX(to)), centerY(to), 0);
+                }
+            }
+        });
+    }
+
+    /*
+    Empty ground where each tile may hold one block, kept off the tile edges so blocks never join into closed walls.
+    */
+    void buildOpen()
+    {
+        std::fill(solid.begin(), solid.end(), std::uint8_t(0));
+        int tilesX = width / OPEN_TILE;
+        int tilesY = height / OPEN_TILE;
+        forRows(0, tilesY, 8, [&](int row)
+        {
+            for (int column = 0; column < tilesX; ++column)
+            {
+                if (random(column, row, 0, 100) >= OPEN_BLOCK_CHANCE)
+                {
+                    continue;
+                }
+                int blockWidth = 1 + int(random(column, row, 1, OPEN_TILE / 2));
+                int blockHeight = 1 + int(random(column, row, 2, OPEN_TILE / 2));
+                int left = column * OPEN_TILE + 1 + int(random(column, row, 3, std::uint32_t(OPEN_TILE - 1 - blockWidth)));
+                int top = row * OPEN_TILE + 1 + int(random(column, row, 4, std::uint32_t(OPEN_TILE - 1 - blockHeight)));
+                fillRect(left, top, left + blockWidth - 1, top + blockHeight - 1, 1);
+            }
+        });
+    }
+
+public:
+
+    /*
+    Params:
+        pool - workers the rows are split across.
+    */
+    explicit MapGenerator(WorkerPool& pool) :
+        pool(pool)
+    {
+    }
+
+    /*
+    Build a level.
+
+    Params:
+        style - kind of level.
+        mapWidth - cells per row, at least 3.
+        mapHeight - number of rows, at least 3.
+        mapSeed - same seed, style and size give the same level.
+        map - set to the level. Its storage is reused, so generating into the same map again does not allocate.
+    */
+    void generate(mapStyle style, int mapWidth, int mapHeight, std::uint64_t mapSeed, GeneratedMap& map)
+    {
+        width = std::max(mapWidth, 3);
+        height = std::max(mapHeight, 3);
+        seed = hash(mapSeed, std::uint64_t(style), 0);
+        solid.resize(size_t(width) * height);
+
+        switch (style)
+        {
+        case MAP_MAZE:
+            buildMaze();
+            break;
+        case MAP_CAVE:
+            buildCave();
+            break;
+        case MAP_ROOMS:
+            buildRooms();
+            break;
+        case MAP_OPEN:
+            buildOpen();
+            break;
+        }
+
+        //solid border and wall materials, varied per 4x4 block so walls show their shape in the 3D view
+        map.width = width;
+        map.height = height;
+        map.cells.resize(size_t(width) * height);
+        forRows(0, height, ROWS_PER_CHUNK, [&](int y)
+        {
+            const std::uint8_t* in = &solid[size_t(y) * width];
+            int* out = &map.cells[size_t(y) * width];
+            bool borderRow = y == 0 || y == height - 1;
+            int material = 1;
+            for (int x = 0; x < width; ++x)
+            {
+                if ((x & 3) == 0)
+                {
+                    material = 1 + int(random(x >> 2, y >> 2, 5, 3));
+                }
+                bool wall = borderRow || x == 0 || x == width - 1 || in[x];
+                out[x] = wall ? material : 0;
+            }
+        });
+    }
+};
@@ -0,0 +1,238 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "BatchRaycaster.h"
+#include "Character.h"
+#include "TraceProfiler.h"
+#include "WorkerPool.h"
+#include "WorldGrid.h"
+
+/*
+Works out what each mirror column of the 3D view reflects.
+
+After Character::calcRays every column that hit a mirror spawns a secondary ray from the hit point with its direction
+reflected off the mirror face. The secondary rays of every camera in the frame are cast together in passes through
+BatchRaycaster, so they use the same packet and threaded kernels as agent batches. A secondary ray that hits another
+mirror is reflected again in the next pass, up to a maximum bounce depth. The total number of secondary rays per frame is
+capped, so a room full of mirrors cannot make a frame take much longer than usual; mirror columns over the budget are drawn
+as plain mirror. Each camera may start an equal share of the budget, so a mirror filling one viewport cannot starve the others.
+Secondary rays stop at transparent walls and show them as opaque: BatchRaycaster keeps no layers, and reflections of
+glass are rare enough that the extra passes are not worth their cost.
+*/
+class MirrorReflections
+{
+
+public:
+
+    //Wall seen in a mirror column. Laid out like a Character hit so the same drawing code can draw it.
+    struct reflectedHit
+    {
+        enum Alignment
+        {
+            horizontal,
+            vertical
+        };
+
+        //1 / distance along the unfolded reflected path, used to project the wall height
+        double inverseDistance{ 0.0 };
+        //0 if the column has no reflection
+        int color{ 0 };
+        Alignment alignment{ horizontal };
+        //mirrors the ray bounced off
+        int bounces{ 0 };
+    };
+
+private:
+
+    BatchRaycaster& raycaster;
+    int rayBudget;
+    int maxBounces;
+    int secondaryCount{ 0 };
+
+    //per camera of the last update, one entry per column
+    std::vector<std::vector<reflectedHit>> reflections;
+
+    //secondary rays of the current pass and the next, structure of arrays so they can be handed to the raycaster
+    struct rayList
+    {
+        std::vector<float> originX;
+        std::vector<float> originY;
+        std::vector<float> dirX;
+        std::vector<float> dirY;
+        std::vector<int> camera;
+        std::vector<int> column;
+        //distance from the camera plane at the ray origin, and how much that grows per pixel along the ray
+        std::vector<double> distance;
+        std::vector<double> distanceScale;
+
+        void clear()
+        {
+            originX.clear();
+            originY.clear();
+            dirX.clear();
+            dirY.clear();
+            camera.clear();
+            column.clear();
+            distance.clear();
+            distanceScale.clear();
+        }
+
+        int size() const
+        {
+            return int(column.size());
+        }
+
+        /*
+        Add a ray bounced off a mirror face. The origin is snapped onto the face so rounding cannot leave it inside the mirror.
+        */
+        void addBounce(float x, float y, float rayDirX, float rayDirY, bool verticalFace, int rayCamera, int rayColumn, double rayDistance, double rayDistanceScale)
+        {
+            if (verticalFace)
+            {
+                x = float(std::round(x / BLOCK_WIDTH) * BLOCK_WIDTH);
+                rayDirX = -rayDirX;
+            }
+            else
+            {
+                y = float(std::round(y / BLOCK_WIDTH) * BLOCK_WIDTH);
+                rayDirY = -rayDirY;
+            }
+            originX.push_back(x);
+            originY.push_back(y);
+            dirX.push_back(rayDirX);
+            dirY.push_back(rayDirY);
+            camera.push_back(rayCamera);
+            column.push_back(rayColumn);
+            distance.push_back(rayDistance);
+            distanceScale.push_back(rayDistanceScale);
+        }
+    };
+    rayList pending;
+    rayList next;
+
+    //raycaster results for the current pass
+    std::vector<float> hitDistance;
+    std::vector<int> hitMaterial;
+    std::vector<std::uint8_t> hitFace;
+
+public:
+
+    /*
+    Params:
+        raycaster - casts the secondary rays, built on the same grid as the character's rays.
+        rayBudget - most secondary rays cast per frame, over all cameras and bounces.
+        maxBounces - most mirrors a ray is reflected by.
+    */
+    MirrorReflections(BatchRaycaster& raycaster, int rayBudget, int maxBounces) :
+        raycaster(raycaster), rayBudget(rayBudget), maxBounces(maxBounces)
+    {
+    }
+
+    /*
+    Cast the secondary rays for every mirror column of the cameras' last calcRays calls, all cameras in one batch per bounce.
+
+    Params:
+        cameras - cameras whose hits and ray end points are reflected.
+        pool - workers the secondary rays are split across.
+    */
+    void update(const std::vector<Character*>& cameras, WorkerPool& pool)
+    {
+        TRACE_ZONE("reflections");
+        int cameraCount = int(cameras.size());
+        reflections.resize(cameraCount);
+        secondaryCount = 0;
+
+        pending.clear();
+        for (int c = 0; c < cameraCount; ++c)
+        {
+            Character& character = *cameras[c];
+            auto& hits = character.getHits();
+            auto& rayCasts = character.getRayCasts();
+            int screenWidth = int(hits.size()) - 1;
+            reflections[c].assign(hits.size(), reflectedHit());
+
+            sf::Vector2<double> dir = character.getDirectionVector();
+            double dirLength = std::sqrt(dir.x * dir.x + dir.y * dir.y);
+
+            //this camera's share of the budget, plus whatever the cameras before it left unused
+            int share = int((long long)rayBudget * (c + 1) / cameraCount);
+            for (int i = 0; i <= screenWidth && pending.size() < share; ++i)
+            {
+                if (!isMirrorMaterial(hits[i].color))
+                {
+                    continue;
+                }
+                double rayDirX, rayDirY;
+                character.calcRayDirection(i, screenWidth, rayDirX, rayDirY);
+                double rayLength = std::sqrt(rayDirX * rayDirX + rayDirY * rayDirY);
+
+                //reflection keeps the path straight when unfolded, so perpendicular distance keeps growing at the primary ray's rate
+                pending.addBounce(rayCasts[i].position.x, rayCasts[i].position.y, float(rayDirX / rayLength), float(rayDirY / rayLength),
+                    hits[i].alignment == hits[i].vertical, c, i, hits[i].distance, dirLength / rayLength);
+            }
+        }
+
+        for (int bounce = 1; pending.size() > 0; ++bounce)
+        {
+            int count = pending.size();
+            hitDistance.resize(count);
+            hitMaterial.resize(count);
+            hitFace.resize(count);
+            raycaster.cast(RayBatchRays{ pending.originX.data(), pending.originY.data(), pending.dirX.data(), pending.dirY.data(), count },
+                RayBatchOutput{ hitDistance.data(), hitMaterial.data(), hitFace.data() }, pool);
+            secondaryCount += count;
+
+            next.clear();
+            for (int j = 0; j < count; ++j)
+            {
+                double distance = pending.distance[j] + hitDistance[j] * pending.distanceScale[j];
+                if (isMirrorMaterial(hitMaterial[j]) && bounce < maxBounces && secondaryCount + next.size() < rayBudget)
+                {
+                    next.addBounce(pending.originX[j] + pending.dirX[j] * hitDistance[j], pending.originY[j] + pending.dirY[j] * hitDistance[j],
+                        pending.dirX[j], pending.dirY[j], hitFace[j] == FACE_VERTICAL, pending.camera[j], pending.column[j], distance, pending.distanceScale[j]);
+                    continue;
+                }
+                if (hitMaterial[j] == 0 || distance <= 0.0)
+                {
+                    continue;
+                }
+
+                reflectedHit& reflection = reflections[pending.camera[j]][pending.column[j]];
+                reflection.inverseDistance = 1 / distance;
+                reflection.color = hitMaterial[j];
+                reflection.alignment = hitFace[j] == FACE_VERTICAL ? reflection.vertical : reflection.horizontal;
+                reflection.bounces = bounce;
+            }
+            std::swap(pending, next);
+        }
+    }
+
+    /*
+    Set the per frame secondary ray budget and the maximum bounce depth.
+    */
+    void setBudget(int rays, int bounces)
+    {
+        rayBudget = rays;
+        maxBounces = bounces;
+    }
+
+    /*
+    Get what each column's mirror reflects for one camera of the last update, one entry per column. Columns without a reflection have color 0.
+    */
+    const std::vector<reflectedHit>& getReflections(int camera) const
+    {
+        return reflections[camera];
+    }
+
+    /*
+    Returns:
+        Number of secondary rays cast by the last update.
+    */
+    int getSecondaryCount() const
+    {
+        return secondaryCount;
+    }
+};
@@ -0,0 +1,533 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "WorkerPool.h"
+#include "WorldGrid.h"
+
+//Cell on the grid, in cell units
+struct GridPoint
+{
+    int x;
+    int y;
+};
+
+//Path request in cell coordinates
+struct PathQuery
+{
+    int startX;
+    int startY;
+    int goalX;
+    int goalY;
+};
+
+//Outcome of one query of a batch, see PathFinder::getPath
+struct PathResult
+{
+    //false if the goal cannot be reached or either end is in a wall
+    bool found;
+    //length in cells, diagonal steps count sqrt(2)
+    float cost;
+    //search context and position of the waypoints in its path buffer
+    int context;
+    int offset;
+    int length;
+};
+
+/*
+Finds shortest 8 connected paths between empty cells of a WorldGrid with jump point search.
+
+Moving diagonally needs both cells beside the move to be empty, so paths never cut wall corners. Paths are returned as the
+jump points they turn at, start and goal included. Consecutive waypoints are joined by a straight or 45 degree line of empty cells.
+
+Straight jumps scan 64 cells at a time: walls are kept as bitsets of blocked cells, one per row and a transposed one per column,
+so a scan finds the next wall or forced neighbour with a count of trailing or leading zeros. The lines are padded with
+a blocked word on both ends and a blocked line on both sides, so scans need no bounds checks.
+
+Per cell search state lives in search contexts that are allocated once and reused. Entries are tagged with a search
+number instead of being cleared, so a query only touches the cells it visits. A batch gives each worker job its own context.
+*/
+class PathFinder
+{
+
+private:
+
+    static constexpr float DIAGONAL_COST = 1.41421356f;
+    //scan result for a line that ends in a wall, and goal position for lines without the goal
+    static constexpr int NO_POSITION = -(1 << 30);
+
+    const WorldGrid& grid;
+    int width;
+    int height;
+
+    //blocked bits, rows for horizontal scans and columns for vertical ones. Line i of a set is at index (i + 1) * words,
+    //cell c of a line is bit c + 64.
+    int rowWords;
+    int columnWords;
+    std::vector<std::uint64_t> rowBits;
+    std::vector<std::uint64_t> columnBits;
+
+    //connected area of each empty cell, -1 for walls. Queries between areas fail without searching.
+    std::vector<int> area;
+
+    //Reusable state of one search
+    struct searchContext
+    {
+        //search number each cell's entries belong to, entries with an older number are unvisited
+        std::vector<std::uint32_t> visited;
+        std::vector<std::uint8_t> closed;
+        std::vector<float> cost;
+        std::vector<int> parent;
+        std::uint32_t search{ 0 };
+
+        //open list as a binary heap of (estimated total cost, cell). Cells may appear more than once, stale entries are skipped.
+        std::vector<std::pair<float, int>> open;
+        //waypoints of the paths found by this context in the current batch, one run per path
+        std::vector<GridPoint> paths;
+    };
+    std::vector<std::unique_ptr<searchContext>> contexts;
+
+    //results of the last batch
+    std::vector<PathResult> results;
+
+    const std::uint64_t* row(int y) const
+    {
+        return &rowBits[size_t(y + 1) * rowWords];
+    }
+
+    const std::uint64_t* column(int x) const
+    {
+        return &columnBits[size_t(x + 1) * columnWords];
+    }
+
+    static bool testBit(const std::uint64_t* line, int position)
+    {
+        return (line[(position + 64) >> 6] >> ((position + 64) & 63)) & 1;
+    }
+
+    bool isWalkable(int x, int y) const
+    {
+        return !testBit(row(y), x);
+    }
+
+    /*
+    Scan along a line from a cell, not including it, for the first jump point: the target, or an empty cell where a side
+    line stops being blocked (a forced neighbour). Stops at the first blocked cell.
+
+    Params:
+        line - blocked bits of the line scanned.
+        sideA, sideB - blocked bits of the lines either side of it.
+        from - position the scan starts next to.
+        step - 1 or -1.
+        target - position of the goal if it is on this line, otherwise a value no scan reaches.
+    Returns:
+        Position of the jump point, or NO_POSITION if the scan hit a blocked cell first.
+    */
+    static int scan(const std::uint64_t* line, const std::uint64_t* sideA, const std::uint64_t* sideB, int from, int step, int target)
+    {
+        int position = from + step;
+        int bit = position + 64;
+        int word = bit >> 6;
+        if (step > 0)
+        {
+            std::uint64_t mask = ~std::uint64_t(0) << (bit & 63);
+            while (true)
+            {
+                //forced where the side line is open here but was blocked one cell back
+                std::uint64_t previousA = (sideA[word] << 1) | (sideA[word - 1] >> 63);
+                std::uint64_t previousB = (sideB[word] << 1) | (sideB[word - 1] >> 63);
+                std::uint64_t forced = (~sideA[word] & previousA) | (~sideB[word] & previousB);
+                std::uint64_t stops = (forced | line[word]) & mask;
+                if (stops)
+                {
+                    int stopBit = __builtin_ctzll(stops);
+                    int stop = word * 64 + stopBit - 64;
+                    if (target >= position && target <= stop)
+                    {
+                        return target;
+                    }
+                    return (line[word] >> stopBit) & 1 ? NO_POSITION : stop;
+                }
+                ++word;
+                mask = ~std::uint64_t(0);
+            }
+        }
+
+        std::uint64_t mask = ~std::uint64_t(0) >> (63 - (bit & 63));
+        while (true)
+        {
+            //forced where the side line is open here but was blocked one cell further on
+            std::uint64_t nextA = (sideA[word] >> 1) | (sideA[word + 1] << 63);
+            std::uint64_t nextB = (sideB[word] >> 1) | (sideB[word + 1] << 63);
+            std::uint64_t forced = (~sideA[word] & nextA) | (~sideB[word] & nextB);
+            std::uint64_t stops = (forced | line[word]) & mask;
+            if (stops)
+            {
+                int stopBit = 63 - __builtin_clzll(stops);
+                int stop = word * 64 + stopBit - 64;
+                if (target <= position && target >= stop)
+                {
+                    return target;
+                }
+                return (line[word] >> stopBit) & 1 ? NO_POSITION : stop;
+            }
+            --word;
+            mask = ~std::uint64_t(0);
+        }
+    }
+
+    /*
+    Jump from a cell in a direction until a jump point, following the pruning rules for paths that do not cut corners.
+
+    Returns:
+        True with the jump point in x and y, or false if the direction leads nowhere.
+    */
+    bool jump(int& x, int& y, int dx, int dy, int goalX, int goalY) const
+    {
+        if (dy == 0)
+        {
+            int stop = scan(row(y), row(y - 1), row(y + 1), x, dx, y == goalY ? goalX : NO_POSITION);
+            x = stop;
+            return stop != NO_POSITION;
+        }
+        if (dx == 0)
+        {
+            int stop = scan(column(x), column(x - 1), column(x + 1), y, dy, x == goalX ? goalY : NO_POSITION);
+            y = stop;
+            return stop != NO_POSITION;
+        }
+
+        //diagonal: step while both cells beside the move are open, stopping where a straight scan finds something
+        while (true)
+        {
+            if (!isWalkable(x + dx, y) || !isWalkable(x, y + dy) || !isWalkable(x + dx, y + dy))
+            {
+                return false;
+            }
+            x += dx;
+            y += dy;
+            if ((x == goalX && y == goalY) ||
+                scan(row(y), row(y - 1), row(y + 1), x, dx, y == goalY ? goalX : NO_POSITION) != NO_POSITION ||
+                scan(column(x), column(x - 1), column(x + 1), y, dy, x == goalX ? goalY : NO_POSITION) != NO_POSITION)
+            {
+                return true;
+            }
+        }
+    }
+
+    static float octile(int dx, int dy)
+    {
+        dx = std::abs(dx);
+        dy = std::abs(dy);
+        return float(std::max(dx, dy) - std::min(dx, dy)) + DIAGONAL_COST * float(std::min(dx, dy));
+    }
+
+    /*
+    Flood fill the empty cells into connected areas. Diagonal moves need both cells beside them empty, so 4 connected
+    areas are exactly the cells that reach each other.
+    */
+    void labelAreas()
+    {
+        area.assign(size_t(width) * height, -1);
+        std::vector<int> stack;
+        int areaCount = 0;
+        for (int start = 0; start < width * height; ++start)
+        {
+            if (area[start] >= 0 || !isWalkable(start % width, start / width))
+            {
+                continue;
+            }
+            area[start] = areaCount;
+            stack.push_back(start);
+            while (!stack.empty())
+            {
+                int cell = stack.back();
+                stack.pop_back();
+                int x = cell % width;
+                int y = cell / width;
+                const int neighbours[4][2] = { { x - 1, y }, { x + 1, y }, { x, y - 1 }, { x, y + 1 } };
+                for (const auto& neighbour : neighbours)
+                {
+                    //padding keeps cells outside the grid blocked
+                    int next = neighbour[1] * width + neighbour[0];
+                    if (isWalkable(neighbour[0], neighbour[1]) && area[next] < 0)
+                    {
+                        area[next] = areaCount;
+                        stack.push_back(next);
+                    }
+                }
+            }
+            ++areaCount;
+        }
+    }
+
+    searchContext& getContext(int index)
+    {
+        while (int(contexts.size()) <= index)
+        {
+            contexts.push_back(nullptr);
+        }
+        if (!contexts[index])
+        {
+            contexts[index].reset(new searchContext());
+            size_t cells = size_t(width) * height;
+            contexts[index]->visited.assign(cells, 0);
+            contexts[index]->closed.assign(cells, 0);
+            contexts[index]->cost.assign(cells, 0.f);
+            contexts[index]->parent.assign(cells, -1);
+        }
+        return *contexts[index];
+    }
+
+    /*
+    Run one query and append its waypoints to the context's path buffer.
+    */
+    PathResult search(searchContext& context, int contextIndex, const PathQuery& query) const
+    {
+        PathResult result{ false, 0.f, contextIndex, int(context.paths.size()), 0 };
+        if (!grid.contains(query.startX, query.startY) || !grid.contains(query.goalX, query.goalY) ||
+            !isWalkable(query.startX, query.startY) || !isWalkable(query.goalX, query.goalY) ||
+            area[query.startY * width + query.startX] != area[query.goalY * width + query.goalX])
+        {
+            return result;
+        }
+
+        //restart the tags when the search number wraps
+        if (++context.search == 0)
+        {
+            std::fill(context.visited.begin(), context.visited.end(), 0);
+            context.search = 1;
+        }
+        auto visit = [&](int cell)
+        {
+            if (context.visited[cell] != context.search)
+            {
+                context.visited[cell] = context.search;
+                context.closed[cell] = 0;
+                context.cost[cell] = 1e30f;
+                context.parent[cell] = -1;
+            }
+        };
+        auto heapOrder = [](const std::pair<float, int>& a, const std::pair<float, int>& b) { return a.first > b.first; };
+
+        int start = query.startY * width + query.startX;
+        int goal = query.goalY * width + query.goalX;
+        visit(start);
+        context.cost[start] = 0.f;
+        context.open.clear();
+        context.open.emplace_back(octile(query.goalX - query.startX, query.goalY - query.startY), start);
+
+        while (!context.open.empty())
+        {
+            std::pop_heap(context.open.begin(), context.open.end(), heapOrder);
+            int cell = context.open.back().second;
+            context.open.pop_back();
+            if (context.closed[cell])
+            {
+                continue;
+            }
+            context.closed[cell] = 1;
+            if (cell == goal)
+            {
+                break;
+            }
+
+            int x = cell % width;
+            int y = cell / width;
+            int parent = context.parent[cell];
+
+            //directions worth jumping in: all 8 from the start, otherwise the pruned set for the direction we arrived from
+            int directions[8][2];
+            int directionCount = 0;
+            auto add = [&](int dx, int dy) { directions[directionCount][0] = dx; directions[directionCount][1] = dy; ++directionCount; };
+            if (parent < 0)
+            {
+                for (int dy = -1; dy <= 1; ++dy)
+                {
+                    for (int dx = -1; dx <= 1; ++dx)
+                    {
+                        if (dx != 0 || dy != 0)
+                        {
+                            add(dx, dy);
+                        }
+                    }
+                }
+            }
+            else
+            {
+                int dx = (x > parent % width) - (x < parent % width);
+                int dy = (y > parent / width) - (y < parent / width);
+                if (dx != 0 && dy != 0)
+                {
+                    add(dx, 0);
+                    add(0, dy);
+                    add(dx, dy);
+                }
+                else if (dx != 0)
+                {
+                    add(dx, 0);
+                    add(0, 1);
+                    add(0, -1);
+                    add(dx, 1);
+                    add(dx, -1);
+                }
+                else
+                {
+                    add(0, dy);
+                    add(1, 0);
+                    add(-1, 0);
+                    add(1, dy);
+                    add(-1, dy);
+                }
+            }
+
+            for (int d = 0; d < directionCount; ++d)
+            {
+                int nextX = x;
+                int nextY = y;
+                if (!jump(nextX, nextY, directions[d][0], directions[d][1], query.goalX, query.goalY))
+                {
+                    continue;
+                }
+
+                int next = nextY * width + nextX;
+                visit(next);
+                if (context.closed[next])
+                {
+                    continue;
+                }
+                float nextCost = context.cost[cell] + octile(nextX - x, nextY - y);
+                if (nextCost < context.cost[next])
+                {
+                    context.cost[next] = nextCost;
+                    context.parent[next] = cell;
+                    context.open.emplace_back(nextCost + octile(query.goalX - nextX, query.goalY - nextY), next);
+                    std::push_heap(context.open.begin(), context.open.end(), heapOrder);
+                }
+            }
+        }
+
+        if (context.visited[goal] != context.search || !context.closed[goal])
+        {
+            return result;
+        }
+        for (int cell = goal; cell >= 0; cell = context.parent[cell])
+        {
+            context.paths.push_back(GridPoint{ cell % width, cell / width });
+        }
+        std::reverse(context.paths.begin() + result.offset, context.paths.end());
+        result.found = true;
+        result.cost = context.cost[goal];
+        result.length = int(context.paths.size()) - result.offset;
+        return result;
+    }
+
+public:
+
+    /*
+    Params:
+        grid - map to search. Must outlive the path finder, call refresh after changing it.
+    */
+    explicit PathFinder(const WorldGrid& grid) :
+        grid(grid)
+    {
+        refresh();
+    }
+
+    /*
+    Rebuild the wall bitsets from the grid, e.g. after WorldGrid::setCell or a restore.
+    */
+    void refresh()
+    {
+        width = grid.getWidth();
+        height = grid.getHeight();
+        rowWords = (width + 63) / 64 + 2;
+        columnWords = (height + 63) / 64 + 2;
+        rowBits.assign(size_t(height + 2) * rowWords, ~std::uint64_t(0));
+        columnBits.assign(size_t(width + 2) * columnWords, ~std::uint64_t(0));
+        for (int y = 0; y < height; ++y)
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                if (!grid.isSolid(x, y))
+                {
+                    rowBits[size_t(y + 1) * rowWords + ((x + 64) >> 6)] &= ~(std::uint64_t(1) << ((x + 64) & 63));
+                    columnBits[size_t(x + 1) * columnWords + ((y + 64) >> 6)] &= ~(std::uint64_t(1) << ((y + 64) & 63));
+                }
+            }
+        }
+        labelAreas();
+        contexts.clear();
+    }
+
+    /*
+    Find a path for a single query on the calling thread.
+
+    Params:
+        query - start and goal cells.
+        path - set to the waypoints from start to goal, empty if there is no path.
+    Returns:
+        Length of the path in cells, or a negative value if there is none.
+    */
+    float findPath(const PathQuery& query, std::vector<GridPoint>& path)
+    {
+        searchContext& context = getContext(0);
+        context.paths.clear();
+        PathResult result = search(context, 0, query);
+        path.assign(context.paths.begin(), context.paths.end());
+        return result.found ? result.cost : -1.f;
+    }
+
+    /*
+    Find paths for many queries at once. Queries are split into one job per worker, each with its own search context.
+
+    Params:
+        queries - start and goal cells of each query.
+        count - number of queries.
+        pool - workers the queries are split across.
+    */
+    void findPaths(const PathQuery* queries, int count, WorkerPool& pool)
+    {
+        int jobs = std::max(1, std::min(count, pool.getThreadCount()));
+        int perJob = (count + jobs - 1) / jobs;
+        for (int job = 0; job < jobs; ++job)
+        {
+            getContext(job).paths.clear();
+        }
+        results.resize(count);
+        pool.parallelFor(count, perJob, [&](int begin, int end)
+        {
+            int job = begin / perJob;
+            searchContext& context = *contexts[job];
+            for (int i = begin; i < end; ++i)
+            {
+                results[i] = search(context, job, queries[i]);
+            }
+        });
+    }
+
+    /*
+    Returns:
+        Results of the last findPaths call, one per query.
+    */
+    const std::vector<PathResult>& getResults() const
+    {
+        return results;
+    }
+
+    /*
+    Get the waypoints of a path from the last findPaths call.
+
+    Params:
+        result - entry of getResults.
+    Returns:
+        First of result.length waypoints, valid until the next call.
+    */
+    const GridPoint* getPath(const PathResult& result) const
+    {
+        return contexts[result.context]->paths.data() + result.offset;
+    }
+};
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define PERF_COUNTERS_LINUX 1
+#endif
+
+//Hardware events PerfCounters can count
+enum perfCounter
+{
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_L1D_MISSES,
+    COUNTER_LLC_MISSES,
+    COUNTER_BRANCH_MISSES,
+    COUNTER_COUNT
+};
+
+/*
+Hardware performance counters of the calling thread, read with perf_event_open.
+
+Each counter is opened on its own, so a CPU or virtual machine lacking one event still counts the others. Counters the
+kernel refuses, e.g. in containers, with perf_event_paranoid set high or on other systems than Linux, are reported
+unavailable rather than failing. Kernel time is excluded, so the default paranoid level of 2 is enough.
+If the kernel has to share the hardware between more events than it has counters, values are scaled up by the share of
+time each event was actually counted.
+*/
+class PerfCounters
+{
+
+private:
+
+    int descriptors[COUNTER_COUNT];
+    double values[COUNTER_COUNT];
+
+#if defined(PERF_COUNTERS_LINUX)
+    static int openCounter(perfCounter counter)
+    {
+        perf_event_attr attributes;
+        std::memset(&attributes, 0, sizeof(attributes));
+        attributes.size = sizeof(attributes);
+        attributes.type = PERF_TYPE_HARDWARE;
+        attributes.disabled = 1;
+        attributes.exclude_kernel = 1;
+        attributes.exclude_hv = 1;
+        attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        switch (counter)
+        {
+        case COUNTER_CYCLES:
+            attributes.config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+        case COUNTER_INSTRUCTIONS:
+            attributes.config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+        case COUNTER_L1D_MISSES:
+            attributes.type = PERF_TYPE_HW_CACHE;
+            attributes.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+        case COUNTER_LLC_MISSES:
+            attributes.config = PERF_COUNT_HW_CACHE_MISSES;
+            break;
+        default:
+            attributes.config = PERF_COUNT_HW_BRANCH_MISSES;
+            break;
+        }
+        //this thread, any CPU
+        return int(syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0));
+    }
+#endif
+
+public:
+
+    PerfCounters()
+    {
+        for (int i = 0; i < COUNTER_COUNT; ++i)
+        {
+#if defined(PERF_COUNTERS_LINUX)
+            descriptors[i] = openCounter(perfCounter(i));
+#else
+            descriptors[i] = -1;
+#endif
+            values[i] = -1.0;
+        }
+    }
+
+    ~PerfCounters()
+    {
+#if defined(PERF_COUNTERS_LINUX)
+        for (int descriptor : descriptors)
+        {
+            if (descriptor >= 0)
+            {
+                close(descriptor);
+            }
+        }
+#endif
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    /*
+    Zero and start every available counter.
+    */
+    void start()
+    {
+#if defined(PERF_COUNTERS_LINUX)
+        for (int descriptor : descriptors)
+        {
+            if (descriptor >= 0)
+            {
+                ioctl(descriptor, PERF_EVENT_IOC_RESET, 0);
+                ioctl(descriptor, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+#endif
+    }
+
+    /*
+    Stop the counters and read their values, see get.
+    */
+    void stop()
+    {
+#if defined(PERF_COUNTERS_LINUX)
+        for (int descriptor : descriptors)
+        {
+            if (descriptor >= 0)
+            {
+                ioctl(descriptor, PERF_EVENT_IOC_DISABLE, 0);
+            }
+        }
+        for (int i = 0; i < COUNTER_COUNT; ++i)
+        {
+            //value, time enabled, time running
+            std::uint64_t result[3];
+            values[i] = -1.0;
+            if (descriptors[i] >= 0 && read(descriptors[i], result, sizeof(result)) == sizeof(result) && result[2] != 0)
+            {
+                values[i] = double(result[0]) * double(result[1]) / double(result[2]);
+            }
+        }
+#endif
+    }
+
+    /*
+    Returns:
+        Events counted between the last start and stop, or a negative value if the counter is unavailable.
+    */
+    double get(perfCounter counter) const
+    {
+        return values[counter];
+    }
+
+    /*
+    Check if the kernel let a counter be opened.
+    */
+    bool isAvailable(perfCounter counter) const
+    {
+        return descriptors[counter] >= 0;
+    }
+
+    static const char* getName(perfCounter counter)
+    {
+        static const char* const NAMES[COUNTER_COUNT] = { "cycles", "instructions", "L1D misses", "LLC misses", "branch misses" };
+        return NAMES[counter];
+    }
+};
@@ -0,0 +1,595 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+#include "BatchRaycaster.h"
+#include "Character.h"
+#include "WorldGrid.h"
+
+//Wall face a reference ray crossed into. t is in ray direction lengths from the origin, as in Character::resolveHit.
+struct OracleFace
+{
+    int color{ 0 };
+    bool vertical{ false };
+    int cellX{ -1 };
+    int cellY{ -1 };
+    long double t{ 0.0L };
+};
+
+//Everything a reference ray found
+struct OracleHit
+{
+    //first opaque wall, color 0 if the ray left the grid or ran out of distance or steps
+    OracleFace wall;
+    //the ray left the grid, wall holds the face it crossed to do so
+    bool leftGrid{ false };
+    //transparent walls in front of the wall, nearest first
+    OracleFace layers[MAX_TRANSPARENT_LAYERS];
+    int layerCount{ 0 };
+    //the ray passed so close to a grid corner or its distance limit that rounding may legitimately change the answer
+    bool ambiguous{ false };
+    //the wall or a layer is hit where the ray starts. Its face passes through the camera and is seen edge on,
+    //so kernels that project faces rather than cast rays may leave it out.
+    bool edgeOn{ false };
+};
+
+/*
+Slow reference ray caster the optimized kernels are checked against.
+
+Unlike the DDA kernels it accumulates nothing: the distance to every grid line is computed directly from the origin in
+long double, and the nearer of the next vertical and horizontal line is crossed, horizontal first on a tie like the kernels.
+Rays crossing close to a grid corner or stopping close to their distance limit are flagged ambiguous, since a kernel
+rounding differently may then pick the other cell and both answers are right.
+*/
+class RaycastOracle
+{
+
+public:
+
+    /*
+    Cast one ray.
+
+    Params:
+        grid - map to cast through. The cell the ray starts in is never hit.
+        originX, originY - start in world pixels.
+        rayDirX, rayDirY - direction, t counts in lengths of it.
+        maxT - the ray gives up before crossing a grid line further than this.
+        maxSteps - the ray gives up after crossing this many grid lines.
+        seeThroughTransparent - record transparent walls as layers and carry on, instead of stopping at them.
+        tolerance - relative difference under which two crossings, or a crossing and maxT, count as a tie.
+    */
+    static OracleHit cast(const WorldGrid& grid, long double originX, long double originY, long double rayDirX, long double rayDirY,
+        long double maxT, int maxSteps, bool seeThroughTransparent, long double tolerance)
+    {
+        OracleHit result;
+        int mapX = int(std::floor(originX / BLOCK_WIDTH));
+        int mapY = int(std::floor(originY / BLOCK_WIDTH));
+        if (!grid.contains(mapX, mapY))
+        {
+            return result;
+        }
+
+        //a ray running along the grid line it starts on may pass either side of it
+        long double length = std::sqrt(rayDirX * rayDirX + rayDirY * rayDirY);
+        if ((std::abs(rayDirX) <= tolerance * length && std::fmod(originX, (long double)BLOCK_WIDTH) == 0) ||
+            (std::abs(rayDirY) <= tolerance * length && std::fmod(originY, (long double)BLOCK_WIDTH) == 0))
+        {
+            result.ambiguous = true;
+        }
+
+        const long double infinity = 1e300L;
+        int stepX = rayDirX < 0 ? -1 : 1;
+        int stepY = rayDirY < 0 ? -1 : 1;
+        //index of the next grid line crossed along each axis
+        int lineX = rayDirX < 0 ? mapX : mapX + 1;
+        int lineY = rayDirY < 0 ? mapY : mapY + 1;
+        for (int step = 0; step < maxSteps; ++step)
+        {
+            long double tX = rayDirX == 0 ? infinity : (lineX * (long double)BLOCK_WIDTH - originX) / rayDirX;
+            long double tY = rayDirY == 0 ? infinity : (lineY * (long double)BLOCK_WIDTH - originY) / rayDirY;
+            bool crossX = tX < tY;
+            long double t = crossX ? tX : tY;
+            long double scale = std::max(t, 1.0L);
+            //except both at the origin, which every kernel works out exactly
+            if (tX < infinity && tY < infinity && std::abs(tX - tY) <= tolerance * scale && t != 0)
+            {
+                result.ambiguous = true;
+            }
+            if (std::abs(t - maxT) <= tolerance * scale)
+            {
+                result.ambiguous = true;
+            }
+            if (t > maxT)
+            {
+                break;
+            }
+
+            if (crossX)
+            {
+                mapX += stepX;
+                lineX += stepX;
+            }
+            else
+            {
+                mapY += stepY;
+                lineY += stepY;
+            }
+            OracleFace face{ 0, crossX, mapX, mapY, t };
+            if (!grid.contains(mapX, mapY))
+            {
+                result.wall = face;
+                result.wall.cellX = result.wall.cellY = -1;
+                result.leftGrid = true;
+                return result;
+            }
+            face.color = grid.at(mapX, mapY);
+            if (face.color == 0)
+            {
+                continue;
+            }
+            if (t <= tolerance)
+            {
+                result.edgeOn = true;
+            }
+            if (seeThroughTransparent && isTransparentMaterial(face.color))
+            {
+                if (result.layerCount < MAX_TRANSPARENT_LAYERS)
+                {
+                    result.layers[result.layerCount++] = face;
+                }
+                continue;
+            }
+            result.wall = face;
+            return result;
+        }
+        return result;
+    }
+
+    /*
+    Direction of the ray a Character casts through a pixel column, worked out from the pose alone.
+
+    Params:
+        dirX, dirY - direction vector.
+        planeX, planeY - camera plane, perpendicular to the direction vector.
+        projection - how columns map to rays.
+        column - pixel column, 0 to screenWidth.
+        screenWidth - number of pixel columns.
+        rayDirX, rayDirY - set to the ray direction.
+    */
+    static void columnDirection(long double dirX, long double dirY, long double planeX, long double planeY, projectionMode projection,
+        int column, int screenWidth, long double& rayDirX, long double& rayDirY)
+    {
+        if (projection == PROJECTION_FLAT)
+        {
+            long double cameraX = 2.0L * column / screenWidth - 1.0L;
+            rayDirX = dirX + planeX * cameraX;
+            rayDirY = dirY + planeY * cameraX;
+            return;
+        }
+        //angular projections spread columns evenly over the field of view, every ray as long as the direction vector
+        const long double pi = 3.14159265358979323846264338327950288L;
+        long double length = std::sqrt(dirX * dirX + dirY * dirY);
+        long double fieldOfView = projection == PROJECTION_PANORAMIC ? 2 * pi : 2 * std::atan2(std::sqrt(planeX * planeX + planeY * planeY), length);
+        long double turn = dirX * planeY - dirY * planeX < 0 ? -1.0L : 1.0L;
+        long double angle = (column / (long double)screenWidth - 0.5L) * fieldOfView * turn;
+        rayDirX = dirX * std::cos(angle) - dirY * std::sin(angle);
+        rayDirY = dirY * std::cos(angle) + dirX * std::sin(angle);
+    }
+};
+
+/*
+Differential tester that checks every ray kernel against RaycastOracle on random cases.
+
+A case is a random map, with or without a border and with every material, a camera pose, a projection, a resolution and
+ray limits. Poses and headings are often snapped to cell centers, grid lines and axes, where ties between crossings
+are most likely. Each case is rendered by column casting with and without the adaptive stride, by the face span sweep
+and by the batch raycaster, and every column is compared with the oracle: the wall's material, face and cell, its distance,
+and the transparent layers in front of it. Columns the oracle flags as ambiguous are skipped, as are walls seen edge on
+from a camera standing on their face for the face span sweep, which culls faces it cannot project.
+
+On the first mismatch the case is minimized, by clearing walls one at a time as long as the same column of the same
+kernel still differs, and printed with the map, the pose and both answers. Minimized cases that once failed are kept in
+regressionCases and checked before the random ones.
+*/
+class DifferentialFuzzer
+{
+
+private:
+
+    //relative tolerances of the double precision Character kernels and the single precision batch kernel
+    static constexpr long double CHARACTER_TOLERANCE = 1e-9L;
+    static constexpr long double BATCH_TOLERANCE = 1e-4L;
+
+    enum kernel
+    {
+        KERNEL_COLUMNS,
+        KERNEL_ADAPTIVE,
+        KERNEL_FACE_SPANS,
+        KERNEL_BATCH,
+        KERNEL_COUNT
+    };
+
+    struct fuzzCase
+    {
+        int width;
+        int height;
+        std::vector<int> cells;
+        double centerX;
+        double centerY;
+        double dirX;
+        double dirY;
+        double planeX;
+        double planeY;
+        projectionMode projection;
+        int columns;
+        double maxDistance;
+        int maxSteps;
+        int stride;
+    };
+
+    //what a kernel returned for one column, in the oracle's terms
+    struct kernelHit
+    {
+        OracleFace wall;
+        int layerCount{ 0 };
+        OracleFace layers[MAX_TRANSPARENT_LAYERS];
+        double distance{ 0.0 };
+    };
+
+    std::mt19937_64 random;
+    std::vector<kernelHit> results;
+    std::vector<float> originX;
+    std::vector<float> originY;
+    std::vector<float> rayX;
+    std::vector<float> rayY;
+    std::vector<float> distance;
+    std::vector<int> material;
+    std::vector<std::uint8_t> face;
+
+    //mismatch found by check
+    int failedColumn{ -1 };
+    char failure[256]{};
+
+    static const char* kernelName(kernel which)
+    {
+        static const char* const NAMES[KERNEL_COUNT] = { "column casting", "adaptive stride", "face spans", "batch raycaster" };
+        return NAMES[which];
+    }
+
+    double uniform(double low, double high)
+    {
+        return std::uniform_real_distribution<double>(low, high)(random);
+    }
+
+    int uniformInt(int low, int high)
+    {
+        return std::uniform_int_distribution<int>(low, high)(random);
+    }
+
+    fuzzCase generate()
+    {
+        static constexpr double PI_VALUE = 3.14159265358979323846;
+        fuzzCase c;
+        c.width = uniformInt(2, 40);
+        c.height = uniformInt(2, 40);
+        double density = uniform(0.0, 0.6);
+        bool border = uniformInt(0, 1) == 1;
+        c.cells.resize(size_t(c.width) * c.height);
+        for (int y = 0; y < c.height; ++y)
+        {
+            for (int x = 0; x < c.width; ++x)
+            {
+                bool edge = x == 0 || y == 0 || x == c.width - 1 || y == c.height - 1;
+                c.cells[size_t(y) * c.width + x] = (border && edge) || uniform(0.0, 1.0) < density ? uniformInt(1, MATERIAL_COUNT - 1) : 0;
+            }
+        }
+
+        //snap the position to cell centers or grid lines a quarter of the time each
+        c.centerX = uniform(0.0, c.width * BLOCK_WIDTH);
+        c.centerY = uniform(0.0, c.height * BLOCK_WIDTH);
+        int snap = uniformInt(0, 3);
+        if (snap == 1 || snap == 2)
+        {
+            double grain = snap == 1 ? BLOCK_WIDTH : BLOCK_WIDTH / 2;
+            c.centerX = std::min(std::round(c.centerX / grain) * grain, c.width * BLOCK_WIDTH - grain / 2);
+            c.centerY = std::min(std::round(c.centerY / grain) * grain, c.height * BLOCK_WIDTH - grain / 2);
+        }
+        //the character keeps its center in floats
+        c.centerX = std::min(float(c.centerX), std::nextafter(float(c.width * BLOCK_WIDTH), 0.f));
+        c.centerY = std::min(float(c.centerY), std::nextafter(float(c.height * BLOCK_WIDTH), 0.f));
+
+        //headings along the axes and diagonals a quarter of the time, exact for the axes
+        double length = uniform(1.0, 64.0);
+        double heading = uniform(-PI_VALUE, PI_VALUE);
+        if (uniformInt(0, 3) == 0)
+        {
+            heading = uniformInt(-4, 4) * PI_VALUE / 4;
+        }
+        c.dirX = std::cos(heading) * length;
+        c.dirY = std::sin(heading) * length;
+        if (std::abs(std::remainder(heading, PI_VALUE / 2)) < 1e-12)
+        {
+            c.dirX = std::round(c.dirX / length) * length;
+            c.dirY = std::round(c.dirY / length) * length;
+        }
+        double planeLength = length * std::tan(uniform(5.0, 170.0) * PI_VALUE / 360.0);
+        double side = uniformInt(0, 1) ? 1.0 : -1.0;
+        c.planeX = -c.dirY / length * planeLength * side;
+        c.planeY = c.dirX / length * planeLength * side;
+
+        c.projection = projectionMode(uniformInt(0, 2));
+        c.columns = uniformInt(1, 700);
+        c.maxDistance = uniform(BLOCK_WIDTH, 4096.0);
+        c.maxSteps = uniformInt(1, 300);
+        c.stride = uniformInt(2, 16);
+        return c;
+    }
+
+    /*
+    Cases that once failed, checked before the random ones on every run. They were recorded with 32 pixel blocks,
+    so world positions and distances are scaled to BLOCK_WIDTH.
+    */
+    static std::vector<fuzzCase> regressionCases()
+    {
+        const double scale = BLOCK_WIDTH / 32;
+        std::vector<fuzzCase> cases;
+
+        //the camera 0.0096 px in front of a grate face. The face span sweep clipped the face at its near plane and lost the layer.
+        fuzzCase grate;
+        grate.width = 19;
+        grate.height = 4;
+        grate.cells.assign(size_t(grate.width) * grate.height, 0);
+        grate.cells[4] = 3;
+        grate.cells[size_t(3) * grate.width + 2] = 5;
+        grate.centerX = float(63.990390777587891 * scale);
+        grate.centerY = float(118.40473937988281 * scale);
+        grate.dirX = 18.347509534092925;
+        grate.dirY = 4.7599319279436019;
+        grate.planeX = 16.307903185981338;
+        grate.planeY = -62.860018528694013;
+        grate.projection = PROJECTION_FLAT;
+        grate.columns = 439;
+        grate.maxDistance = 49.366002213735115 * scale;
+        grate.maxSteps = 214;
+        grate.stride = 12;
+        cases.push_back(grate);
+        return cases;
+    }
+
+    /*
+    Render a case with one kernel into results, one entry per column.
+    */
+    void runKernel(const fuzzCase& c, const WorldGrid& grid, kernel which)
+    {
+        results.assign(c.columns + 1, kernelHit());
+        if (which == KERNEL_BATCH)
+        {
+            //unit directions in cell units, the batch kernel's inputs, rounded to float first so the oracle sees the same rays
+            originX.assign(c.columns + 1, float(c.centerX / BLOCK_WIDTH));
+            originY.assign(c.columns + 1, float(c.centerY / BLOCK_WIDTH));
+            rayX.resize(c.columns + 1);
+            rayY.resize(c.columns + 1);
+            distance.resize(c.columns + 1);
+            material.resize(c.columns + 1);
+            face.resize(c.columns + 1);
+            for (int i = 0; i <= c.columns; ++i)
+            {
+                long double x, y;
+                RaycastOracle::columnDirection(c.dirX, c.dirY, c.planeX, c.planeY, c.projection, i, c.columns, x, y);
+                long double length = std::sqrt(x * x + y * y);
+                rayX[i] = float(x / length);
+                rayY[i] = float(y / length);
+            }
+            BatchRaycaster raycaster(grid);
+            raycaster.castRays(originX.data(), originY.data(), rayX.data(), rayY.data(), c.columns + 1, distance.data(), material.data(), face.data());
+            for (int i = 0; i <= c.columns; ++i)
+            {
+                results[i].wall.color = material[i];
+                results[i].wall.vertical = face[i] == FACE_VERTICAL;
+                results[i].distance = distance[i];
+            }
+            return;
+        }
+
+        Character character(16.f, c.dirX, c.dirY, c.planeX, c.planeY, sf::Color(255, 255, 255));
+        character.teleport(float(c.centerX), float(c.centerY));
+        character.setProjection(c.projection);
+        character.setMaxRayDistance(c.maxDistance, c.maxSteps);
+        character.setRayEngine(which == KERNEL_FACE_SPANS ? rayEngine::FACE_SPANS : rayEngine::COLUMN_CASTING);
+        character.setAdaptiveStride(which == KERNEL_ADAPTIVE ? c.stride : 1);
+        auto& hits = character.getHits();
+        character.calcRays(hits, c.columns, grid);
+        for (int i = 0; i <= c.columns; ++i)
+        {
+            kernelHit& result = results[i];
+            result.wall = OracleFace{ hits[i].color, hits[i].alignment == hits[i].vertical, hits[i].cellX, hits[i].cellY, 0.0L };
+            result.distance = hits[i].distance;
+            result.layerCount = hits[i].layerCount;
+            for (int layer = 0; layer < hits[i].layerCount && layer < MAX_TRANSPARENT_LAYERS; ++layer)
+            {
+                const auto& found = character.getLayers()[i][layer];
+                result.layers[layer] = OracleFace{ found.color, found.alignment == found.vertical, found.cellX, found.cellY, found.distance };
+            }
+        }
+    }
+
+    static bool near(long double expected, long double actual, long double tolerance)
+    {
+        return std::abs(expected - actual) <= tolerance * std::max(std::abs(expected), 1.0L);
+    }
+
+    /*
+    Compare the columns of results with the oracle, from firstColumn to lastColumn.
+
+    Returns:
+        False on the first mismatch, with failedColumn and failure set.
+    */
+    bool check(const fuzzCase& c, const WorldGrid& grid, kernel which, int firstColumn, int lastColumn, long long& compared, long long& skipped)
+    {
+        long double dirLength = std::sqrt((long double)c.dirX * c.dirX + (long double)c.dirY * c.dirY);
+        for (int i = firstColumn; i <= lastColumn; ++i)
+        {
+            const kernelHit& got = results[i];
+            OracleHit expected;
+            bool same = true;
+            if (which == KERNEL_BATCH)
+            {
+                expected = RaycastOracle::cast(grid, (long double)originX[i] * BLOCK_WIDTH, (long double)originY[i] * BLOCK_WIDTH, rayX[i], rayY[i],
+                    1e300L, grid.getWidth() + grid.getHeight() + 2, false, BATCH_TOLERANCE);
+                if (!expected.ambiguous)
+                {
+                    //the batch kernel reports the face it stopped on, and the distance to it, even when leaving the grid
+                    same = got.wall.color == std::max(expected.wall.color, 0) && (expected.wall.color == 0 && !expected.leftGrid ?
+                        true : got.wall.vertical == expected.wall.vertical && near(expected.wall.t, got.distance, 1e-3L));
+                }
+            }
+            else
+            {
+                long double x, y;
+                RaycastOracle::columnDirection(c.dirX, c.dirY, c.planeX, c.planeY, c.projection, i, c.columns, x, y);
+                expected = RaycastOracle::cast(grid, c.centerX, c.centerY, x, y, c.maxDistance / dirLength, c.maxSteps, true, CHARACTER_TOLERANCE);
+                if (!expected.ambiguous)
+                {
+                    const OracleFace& wall = expected.wall;
+                    same = got.layerCount == expected.layerCount;
+                    if (wall.color > 0)
+                    {
+                        same = same && got.wall.color == wall.color && got.wall.vertical == wall.vertical && got.wall.cellX == wall.cellX &&
+                            got.wall.cellY == wall.cellY && near(wall.t * dirLength, got.distance, CHARACTER_TOLERANCE * 100);
+                    }
+                    else
+                    {
+                        same = same && got.wall.color == 0 && got.wall.cellX == -1 && got.distance == c.maxDistance;
+                    }
+                    for (int layer = 0; same && layer < expected.layerCount; ++layer)
+                    {
+                        const OracleFace& want = expected.layers[layer];
+                        const OracleFace& found = got.layers[layer];
+                        same = found.color == want.color && found.vertical == want.vertical && found.cellX == want.cellX && found.cellY == want.cellY &&
+                            near(want.t * dirLength, found.t, CHARACTER_TOLERANCE * 100);
+                    }
+                }
+            }
+
+            if (expected.ambiguous || (expected.edgeOn && which == KERNEL_FACE_SPANS))
+            {
+                ++skipped;
+                continue;
+            }
+            ++compared;
+            if (!same)
+            {
+                failedColumn = i;
+                std::snprintf(failure, sizeof(failure),
+                    "expected color %d %s cell (%d, %d) distance %.9Lg layers %d, got color %d %s cell (%d, %d) distance %.9g layers %d",
+                    expected.wall.color, expected.wall.vertical ? "vertical" : "horizontal", expected.wall.cellX, expected.wall.cellY,
+                    which == KERNEL_BATCH ? expected.wall.t : expected.wall.t * dirLength, expected.layerCount,
+                    got.wall.color, got.wall.vertical ? "vertical" : "horizontal", got.wall.cellX, got.wall.cellY, got.distance, got.layerCount);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /*
+    Clear walls while the same column of the same kernel keeps failing, then print the case.
+    */
+    void report(fuzzCase c, kernel which, const char* label, int caseIndex)
+    {
+        int column = failedColumn;
+        long long compared = 0;
+        long long skipped = 0;
+        for (size_t cell = 0; cell < c.cells.size(); ++cell)
+        {
+            if (c.cells[cell] == 0)
+            {
+                continue;
+            }
+            fuzzCase smaller = c;
+            smaller.cells[cell] = 0;
+            WorldGrid grid(smaller.width, smaller.height, smaller.cells);
+            runKernel(smaller, grid, which);
+            if (!check(smaller, grid, which, column, column, compared, skipped))
+            {
+                c = smaller;
+            }
+        }
+
+        //rerun the minimized case to report its answers
+        WorldGrid grid(c.width, c.height, c.cells);
+        runKernel(c, grid, which);
+        check(c, grid, which, column, column, compared, skipped);
+        static const char* const PROJECTIONS[] = { "flat", "cylindrical", "panoramic" };
+        std::printf("%s %d: %s differs from the reference at column %d of %d\n%s\n", label, caseIndex, kernelName(which), column, c.columns, failure);
+        std::printf("center (%.17g, %.17g) dir (%.17g, %.17g) plane (%.17g, %.17g) %s, max distance %.17g, max steps %d, stride %d\n",
+            c.centerX, c.centerY, c.dirX, c.dirY, c.planeX, c.planeY, PROJECTIONS[c.projection], c.maxDistance, c.maxSteps, c.stride);
+        for (int y = 0; y < c.height; ++y)
+        {
+            for (int x = 0; x < c.width; ++x)
+            {
+                std::printf("%d%s", c.cells[size_t(y) * c.width + x], x + 1 < c.width ? "," : "\n");
+            }
+        }
+    }
+
+    /*
+    Render a case with every kernel and compare each with the reference, reporting the first mismatch.
+
+    Returns:
+        True if every kernel matched the reference.
+    */
+    bool checkCase(const fuzzCase& c, const char* label, int caseIndex, long long& compared, long long& skipped)
+    {
+        WorldGrid grid(c.width, c.height, c.cells);
+        for (int which = 0; which < KERNEL_COUNT; ++which)
+        {
+            runKernel(c, grid, kernel(which));
+            if (!check(c, grid, kernel(which), 0, c.columns, compared, skipped))
+            {
+                report(c, kernel(which), label, caseIndex);
+                return false;
+            }
+        }
+        return true;
+    }
+
+public:
+
+    /*
+    Fuzz the kernels and print the result to stdout. The regression cases are checked first.
+
+    Params:
+        seed - seeds the random cases, the same seed gives the same cases.
+        caseCount - number of cases to try.
+    Returns:
+        True if every kernel matched the reference on every case.
+    */
+    bool run(std::uint64_t seed, int caseCount)
+    {
+        random.seed(seed);
+        long long compared = 0;
+        long long skipped = 0;
+        std::vector<fuzzCase> regressions = regressionCases();
+        for (int caseIndex = 0; caseIndex < int(regressions.size()); ++caseIndex)
+        {
+            if (!checkCase(regressions[caseIndex], "Regression case", caseIndex, compared, skipped))
+            {
+                return false;
+            }
+        }
+        for (int caseIndex = 0; caseIndex < caseCount; ++caseIndex)
+        {
+            if (!checkCase(generate(), "Fuzz case", caseIndex, compared, skipped))
+            {
+                return false;
+            }
+        }
+        std::printf("Fuzzed %d cases with seed %llu: %lld columns match the reference, %lld ambiguous columns skipped\n",
+            caseCount, static_cast<unsigned long long>(seed), compared, skipped);
+        return true;
+    }
+};
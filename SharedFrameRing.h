@@ -0,0 +1,422 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SHARED_FRAME_RING_POSIX 1
+#endif
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "frame sequence numbers must be lock free to be shared between processes");
+
+//One column of a published frame, a fixed layout copy of Character's hit for that column.
+struct SharedColumnHit
+{
+    //distance from the camera plane in world pixels, as in Character hits
+    float distance;
+    //material of the wall hit, 0 if none
+    std::int32_t color;
+    //1 if the wall face crosses an X grid line
+    std::uint8_t vertical;
+    //transparent walls in front of the hit
+    std::uint8_t layerCount;
+    //viewport the column belongs to, see ViewportRenderer
+    std::uint8_t viewport;
+    std::uint8_t reserved;
+};
+
+//Start of the shared memory object, followed by slotCount slots of slotSize bytes.
+struct SharedFrameHeader
+{
+    static constexpr std::uint32_t MAGIC = 0x52434652; //"RCFR"
+    static constexpr std::uint32_t VERSION = 1;
+
+    std::uint32_t magic;
+    std::uint32_t version;
+    std::uint32_t slotCount;
+    //pixel capacity of a slot is maxWidth * height, the column capacity maxColumns
+    std::uint32_t maxWidth;
+    std::uint32_t height;
+    std::uint32_t maxColumns;
+    std::uint64_t slotSize;
+    //number of frames published so far. Frame n is stored in slot n % slotCount.
+    alignas(64) std::atomic<std::uint64_t> published;
+};
+
+//Start of a slot, followed by maxColumns SharedColumnHit at columnsOffset() and the pixels at pixelsOffset().
+struct SharedFrameSlot
+{
+    //2 * frame + 1 while the frame is being written, 2 * frame + 2 once it is published
+    std::atomic<std::uint64_t> sequence;
+    std::uint32_t width;
+    std::uint32_t height;
+    std::uint32_t columnCount;
+    std::uint32_t viewportCount;
+};
+
+/*
+Shared memory layout, used by both ends of the ring.
+*/
+namespace sharedFrameLayout
+{
+    constexpr std::uint64_t ALIGNMENT = 64;
+
+    constexpr std::uint64_t alignUp(std::uint64_t size)
+    {
+        return (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    }
+
+    constexpr std::uint64_t headerSize()
+    {
+        return alignUp(sizeof(SharedFrameHeader));
+    }
+
+    constexpr std::uint64_t columnsOffset()
+    {
+        return alignUp(sizeof(SharedFrameSlot));
+    }
+
+    constexpr std::uint64_t pixelsOffset(std::uint32_t maxColumns)
+    {
+        return columnsOffset() + alignUp(std::uint64_t(maxColumns) * sizeof(SharedColumnHit));
+    }
+
+    constexpr std::uint64_t slotSize(std::uint32_t maxWidth, std::uint32_t height, std::uint32_t maxColumns)
+    {
+        return alignUp(pixelsOffset(maxColumns) + std::uint64_t(maxWidth) * height * sizeof(std::uint32_t));
+    }
+}
+
+/*
+Publishes rendered frames and their column hits to other processes through a POSIX shared memory ring of frame slots.
+
+The renderer draws straight into the slot returned by beginFrame, and consumers read the slot in place from their own
+read only mapping, so a frame reaches another process without being copied or serialized.
+
+There is one writer and any number of readers, and neither side ever waits. Each slot carries a sequence number used as a
+seqlock: it is odd while the slot is written and even once the frame is published. A reader checks it before and after
+using a frame and drops the frame if the writer lapped it, which takes slotCount - 1 more frames.
+*/
+class SharedFrameRing
+{
+
+private:
+
+    char name[64]{};
+    unsigned char* memory{ nullptr };
+    std::uint64_t mappedSize{ 0 };
+    SharedFrameHeader* header{ nullptr };
+    SharedFrameSlot* writing{ nullptr };
+
+    SharedFrameSlot* slot(std::uint64_t frame) const
+    {
+        return reinterpret_cast<SharedFrameSlot*>(memory + sharedFrameLayout::headerSize() + frame % header->slotCount * header->slotSize);
+    }
+
+public:
+
+    //where the renderer writes the frame being built
+    struct writeSlot
+    {
+        std::uint32_t* pixels;
+        SharedColumnHit* columns;
+        int maxColumns;
+    };
+
+    SharedFrameRing() = default;
+    SharedFrameRing(const SharedFrameRing&) = delete;
+    SharedFrameRing& operator=(const SharedFrameRing&) = delete;
+
+    ~SharedFrameRing()
+    {
+        close();
+    }
+
+    /*
+    Create the shared memory object, replacing any left behind by a previous run.
+
+    Params:
+        objectName - POSIX shared memory name, starting with '/'.
+        slotCount - frames kept, at least 2. More slots give slow readers longer before a frame is overwritten.
+        maxWidth - widest frame in pixels.
+        height - frame height in pixels.
+        maxColumns - most column hits per frame, over all viewports.
+    Returns:
+        False if shared memory is unavailable, in which case nothing is published.
+    */
+    bool create(const char* objectName, int slotCount, int maxWidth, int height, int maxColumns)
+    {
+        close();
+#if defined(SHARED_FRAME_RING_POSIX)
+        std::strncpy(name, objectName, sizeof(name) - 1);
+        shm_unlink(name);
+        int descriptor = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (descriptor < 0)
+        {
+            return false;
+        }
+
+        std::uint64_t slotSize = sharedFrameLayout::slotSize(maxWidth, height, maxColumns);
+        std::uint64_t size = sharedFrameLayout::headerSize() + slotSize * std::max(slotCount, 2);
+        void* mapped = ftruncate(descriptor, off_t(size)) == 0 ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0) : MAP_FAILED;
+        ::close(descriptor);
+        if (mapped == MAP_FAILED)
+        {
+            shm_unlink(name);
+            return false;
+        }
+
+        //ftruncate zero fills, so every slot starts unpublished with sequence 0
+        memory = static_cast<unsigned char*>(mapped);
+        mappedSize = size;
+        header = new (memory) SharedFrameHeader{ SharedFrameHeader::MAGIC, SharedFrameHeader::VERSION, std::uint32_t(std::max(slotCount, 2)),
+            std::uint32_t(maxWidth), std::uint32_t(height), std::uint32_t(maxColumns), slotSize, { 0 } };
+        header->published.store(0, std::memory_order_release);
+        return true;
+#else
+        (void)objectName, (void)slotCount, (void)maxWidth, (void)height, (void)maxColumns;
+        return false;
+#endif
+    }
+
+    /*
+    Unmap and remove the shared memory object. Readers keep their mappings until they close them.
+    */
+    void close()
+    {
+#if defined(SHARED_FRAME_RING_POSIX)
+        if (memory)
+        {
+            munmap(memory, mappedSize);
+            shm_unlink(name);
+        }
+#endif
+        memory = nullptr;
+        header = nullptr;
+        writing = nullptr;
+    }
+
+    bool isOpen() const
+    {
+        return memory != nullptr;
+    }
+
+    /*
+    Claim the slot for the next frame and mark it as being written. Readers skip it until publish.
+
+    Returns:
+        Pixel and column storage of the slot, for FrameBuffer::setTarget and ViewportRenderer::setColumnSink.
+    */
+    writeSlot beginFrame()
+    {
+        std::uint64_t frame = header->published.load(std::memory_order_relaxed);
+        writing = slot(frame);
+        writing->sequence.store(2 * frame + 1, std::memory_order_relaxed);
+        //the odd sequence must be visible before any of the new frame's data
+        std::atomic_thread_fence(std::memory_order_release);
+
+        unsigned char* base = reinterpret_cast<unsigned char*>(writing);
+        return writeSlot{ reinterpret_cast<std::uint32_t*>(base + sharedFrameLayout::pixelsOffset(header->maxColumns)),
+            reinterpret_cast<SharedColumnHit*>(base + sharedFrameLayout::columnsOffset()), int(header->maxColumns) };
+    }
+
+    /*
+    Publish the frame started by beginFrame.
+
+    Params:
+        width - columns per pixel row, rows are stored back to back.
+        height - pixel rows.
+        columnCount - column hits written.
+        viewportCount - viewports the columns belong to.
+    */
+    void publish(int width, int height, int columnCount, int viewportCount)
+    {
+        std::uint64_t frame = header->published.load(std::memory_order_relaxed);
+        writing->width = std::uint32_t(width);
+        writing->height = std::uint32_t(height);
+        writing->columnCount = std::uint32_t(columnCount);
+        writing->viewportCount = std::uint32_t(viewportCount);
+        writing->sequence.store(2 * frame + 2, std::memory_order_release);
+        header->published.store(frame + 1, std::memory_order_release);
+        writing = nullptr;
+    }
+};
+
+/*
+Read only view of a SharedFrameRing in another process.
+
+Frames are used in place. Acquire a frame, read what is needed from it, then call isValid: if the writer overwrote
+the slot in the meantime the data read may be torn and must be discarded.
+*/
+class SharedFrameReader
+{
+
+private:
+
+    const unsigned char* memory{ nullptr };
+    std::uint64_t mappedSize{ 0 };
+    const SharedFrameHeader* header{ nullptr };
+
+    const SharedFrameSlot* slot(std::uint64_t frame) const
+    {
+        return reinterpret_cast<const SharedFrameSlot*>(memory + sharedFrameLayout::headerSize() + frame % header->slotCount * header->slotSize);
+    }
+
+public:
+
+    //A published frame, pointing into the shared mapping.
+    struct frameView
+    {
+        std::uint64_t frame;
+        int width;
+        int height;
+        int columnCount;
+        int viewportCount;
+        const std::uint32_t* pixels;
+        const SharedColumnHit* columns;
+        //slot and sequence number the frame was acquired with, checked by isValid
+        const SharedFrameSlot* slot;
+        std::uint64_t sequence;
+    };
+
+    SharedFrameReader() = default;
+    SharedFrameReader(const SharedFrameReader&) = delete;
+    SharedFrameReader& operator=(const SharedFrameReader&) = delete;
+
+    ~SharedFrameReader()
+    {
+        close();
+    }
+
+    /*
+    Map a ring created by SharedFrameRing::create.
+
+    Params:
+        objectName - name passed to create.
+    Returns:
+        False if the ring does not exist or has an unknown layout.
+    */
+    bool open(const char* objectName)
+    {
+        close();
+#if defined(SHARED_FRAME_RING_POSIX)
+        int descriptor = shm_open(objectName, O_RDONLY, 0);
+        if (descriptor < 0)
+        {
+            return false;
+        }
+        struct stat info;
+        void* mapped = fstat(descriptor, &info) == 0 && std::uint64_t(info.st_size) >= sharedFrameLayout::headerSize() ?
+            mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_SHARED, descriptor, 0) : MAP_FAILED;
+        ::close(descriptor);
+        if (mapped == MAP_FAILED)
+        {
+            return false;
+        }
+
+        memory = static_cast<const unsigned char*>(mapped);
+        mappedSize = std::uint64_t(info.st_size);
+        header = reinterpret_cast<const SharedFrameHeader*>(memory);
+        if (header->magic != SharedFrameHeader::MAGIC || header->version != SharedFrameHeader::VERSION ||
+            sharedFrameLayout::headerSize() + header->slotSize * header->slotCount > mappedSize)
+        {
+            close();
+            return false;
+        }
+        return true;
+#else
+        (void)objectName;
+        return false;
+#endif
+    }
+
+    void close()
+    {
+#if defined(SHARED_FRAME_RING_POSIX)
+        if (memory)
+        {
+            munmap(const_cast<unsigned char*>(memory), mappedSize);
+        }
+#endif
+        memory = nullptr;
+        header = nullptr;
+    }
+
+    /*
+    Returns:
+        Number of frames the writer has published so far.
+    */
+    std::uint64_t getPublishedCount() const
+    {
+        return header->published.load(std::memory_order_acquire);
+    }
+
+    /*
+    Acquire a frame by number, e.g. every frame in turn for a recorder.
+
+    Params:
+        frame - frame number, counting from 0.
+        view - set to the frame on success.
+    Returns:
+        False if the frame is not published yet or has already been overwritten.
+    */
+    bool acquire(std::uint64_t frame, frameView& view) const
+    {
+        const SharedFrameSlot* frameSlot = slot(frame);
+        std::uint64_t sequence = frameSlot->sequence.load(std::memory_order_acquire);
+        if (sequence != 2 * frame + 2)
+        {
+            return false;
+        }
+
+        const unsigned char* base = reinterpret_cast<const unsigned char*>(frameSlot);
+        view.frame = frame;
+        view.width = int(frameSlot->width);
+        view.height = int(frameSlot->height);
+        view.columnCount = int(frameSlot->columnCount);
+        view.viewportCount = int(frameSlot->viewportCount);
+        view.pixels = reinterpret_cast<const std::uint32_t*>(base + sharedFrameLayout::pixelsOffset(header->maxColumns));
+        view.columns = reinterpret_cast<const SharedColumnHit*>(base + sharedFrameLayout::columnsOffset());
+        view.slot = frameSlot;
+        view.sequence = sequence;
+        //the size fields could have been rewritten for a newer frame after the sequence was read
+        return isValid(view);
+    }
+
+    /*
+    Acquire the newest published frame.
+
+    Returns:
+        False if nothing has been published, or the writer lapped the reader while acquiring.
+    */
+    bool acquireLatest(frameView& view) const
+    {
+        std::uint64_t published = getPublishedCount();
+        return published > 0 && acquire(published - 1, view);
+    }
+
+    /*
+    Check that a frame has not been overwritten since it was acquired. Call after reading from it.
+    */
+    bool isValid(const frameView& view) const
+    {
+        //order the caller's reads of the frame before the second sequence read
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return view.slot->sequence.load(std::memory_order_relaxed) == view.sequence;
+    }
+
+    /*
+    Returns:
+        Shape of the ring, as given to SharedFrameRing::create.
+    */
+    const SharedFrameHeader& getHeader() const
+    {
+        return *header;
+    }
+};
@@ -0,0 +1,348 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "Character.h"
+#include "FieldOfView.h"
+#include "FrameBuffer.h"
+#include "TraceProfiler.h"
+
+static constexpr int SPRITE_TEXTURE_SIZE = 64;
+//sprite type 0 is unused so types line up with map materials
+static constexpr int SPRITE_TYPE_COUNT = 4;
+//number of screen columns summarized by one entry of the coarse depth buffer
+static constexpr int DEPTH_TILE_WIDTH = 16;
+
+//Object in the world drawn as a billboard that always faces the camera. Position is in world pixels.
+struct SpriteEntity
+{
+    float x{ 0.0f };
+    float y{ 0.0f };
+    int type{ 1 };
+};
+
+/*
+Draws sprite entities into the frame buffer of the 3D view after the walls.
+
+Sprites are kept in per-cell buckets, so only the cells under the view cone are visited each frame rather than every entity.
+Cells the field of view set with setFieldOfView has not marked visible are skipped for the character it was computed for.
+Candidates are culled against the screen edges and a coarse max-depth buffer built from the wall hits before any column work.
+Survivors are sorted back to front and clipped per column against the wall distance in hits.
+Visible columns are copied from the texture atlas straight into the frame buffer, so sprites go up with the frame's single upload.
+*/
+class SpriteRenderer
+{
+
+private:
+
+    //sprite that survived culling, in screen space
+    struct VisibleSprite
+    {
+        int id;
+        double distance;
+        double screenX;
+        double size;
+    };
+
+    std::vector<SpriteEntity> sprites;
+    //cell each sprite is currently stored in
+    std::vector<int> spriteCells;
+    //ids of the sprites inside each map cell
+    std::vector<std::vector<int>> cellSprites;
+
+    //per frame scratch buffers, kept to avoid reallocating
+    std::vector<double> tileMaxDepth;
+    std::vector<VisibleSprite> visible;
+
+    //all sprite textures side by side, packed like frame buffer pixels. Alpha 0 is see through.
+    std::vector<std::uint32_t> atlas;
+
+    //visible cells of one character, nullptr to draw every cell under the view cone
+    const FieldOfView* fieldOfView{ nullptr };
+
+    /*
+    Get index of the cell containing a world position, clamped to the map.
+    */
+    int cellIndex(float x, float y)
+    {
+        int cellX = std::min(std::max(int(x / BLOCK_WIDTH), 0), WORLD_BLOCK_WIDTH - 1);
+        int cellY = std::min(std::max(int(y / BLOCK_WIDTH), 0), WORLD_BLOCK_HEIGHT - 1);
+        return cellY * WORLD_BLOCK_WIDTH + cellX;
+    }
+
+    /*
+    Generate the sprite textures: 1 is a barrel, 2 a pillar and 3 a lamp. Pixels outside the shapes are transparent.
+    */
+    void generateAtlas()
+    {
+        const int size = SPRITE_TEXTURE_SIZE;
+        atlas.assign(size_t(size) * size * SPRITE_TYPE_COUNT, packColor(0, 0, 0, 0));
+        auto pixel = [&](int type, int x, int y) -> std::uint32_t& { return atlas[size_t(y) * size * SPRITE_TYPE_COUNT + type * size + x]; };
+
+        for (int y = 0; y < size; ++y)
+        {
+            for (int x = 0; x < size; ++x)
+            {
+                int fromCenter = std::abs(x - size / 2);
+
+                //barrel: lower half of the sprite with darker metal bands
+                if (y >= size / 2 && fromCenter < size / 5)
+                {
+                    bool band = (y - size / 2) % 10 < 2;
+                    pixel(1, x, y) = band ? packColor(60, 60, 60) : packColor(130, 80, 35);
+                }
+
+                //pillar: full height column, shaded towards its edges
+                if (fromCenter < size / 8)
+                {
+                    std::uint8_t shade = std::uint8_t(200 - fromCenter * 10);
+                    pixel(2, x, y) = packColor(shade, shade, shade);
+                }
+
+                //lamp: thin post with a glowing globe on top
+                int globeY = y - size / 5;
+                if (fromCenter * fromCenter + globeY * globeY < (size / 8) * (size / 8))
+                {
+                    pixel(3, x, y) = packColor(255, 240, 150);
+                }
+                else if (y > size / 5 && fromCenter < 2)
+                {
+                    pixel(3, x, y) = packColor(40, 40, 40);
+                }
+            }
+        }
+    }
+
+    /*
+    Copy columns [left, right) of a sprite from the atlas into the frame buffer, skipping see through texels.
+    Each pixel samples the texel under its center.
+
+    Params:
+        frameBuffer - buffer to draw in.
+        sprite - sprite to draw.
+        left, right - columns of the view to draw, within the sprite.
+        viewLeft, viewTop - frame buffer pixel of the view's top left corner.
+        screenHeight - height of the view in pixels.
+    */
+    void drawColumns(FrameBuffer& frameBuffer, const VisibleSprite& sprite, int left, int right, int viewLeft, int viewTop, int screenHeight)
+    {
+        const int size = SPRITE_TEXTURE_SIZE;
+        double spriteLeft = sprite.screenX - sprite.size / 2;
+        int type = sprites[sprite.id].type;
+
+        //sprites stand on the floor, which a full height wall at the same distance would meet.
+        double bottom = screenHeight / 2 + sprite.size / 2;
+        double top = bottom - sprite.size;
+        int first = std::max(int(std::ceil(top - 0.5)), 0);
+        int last = std::min(int(std::ceil(bottom - 0.5)), screenHeight);
+
+        for (int y = first; y < last; ++y)
+        {
+            int texY = std::min(std::max(int((y + 0.5 - top) / sprite.size * size), 0), size - 1);
+            const std::uint32_t* texels = &atlas[size_t(texY) * size * SPRITE_TYPE_COUNT + type * size];
+            std::uint32_t* pixels = frameBuffer.row(viewTop + y) + viewLeft;
+            for (int x = left; x < right; ++x)
+            {
+                int texX = std::min(std::max(int((x + 0.5 - spriteLeft) / sprite.size * size), 0), size - 1);
+                if (texels[texX] >> 24)
+                {
+                    pixels[x] = texels[texX];
+                }
+            }
+        }
+    }
+
+public:
+
+    SpriteRenderer() :
+        cellSprites(size_t(WORLD_BLOCK_WIDTH) * WORLD_BLOCK_HEIGHT)
+    {
+        generateAtlas();
+    }
+
+    /*
+    Add a sprite to the world.
+
+    Params:
+        x - world X coordinate of the sprite center.
+        y - world Y coordinate of the sprite center.
+        type - which texture to draw, 1 to SPRITE_TYPE_COUNT - 1.
+    Returns:
+        Id used to move the sprite later.
+    */
+    int addSprite(float x, float y, int type)
+    {
+        int id = int(sprites.size());
+        sprites.push_back(SpriteEntity{ x, y, std::min(std::max(type, 1), SPRITE_TYPE_COUNT - 1) });
+        spriteCells.push_back(cellIndex(x, y));
+        cellSprites[spriteCells.back()].push_back(id);
+        return id;
+    }
+
+    /*
+    Move a sprite, updating its cell bucket if it crossed into another cell.
+
+    Params:
+        id - id returned by addSprite.
+        x - new world X coordinate.
+        y - new world Y coordinate.
+    */
+    void moveSprite(int id, float x, float y)
+    {
+        sprites[id].x = x;
+        sprites[id].y = y;
+        int newCell = cellIndex(x, y);
+        if (newCell != spriteCells[id])
+        {
+            auto& oldBucket = cellSprites[spriteCells[id]];
+            auto found = std::find(oldBucket.begin(), oldBucket.end(), id);
+            *found = oldBucket.back();
+            oldBucket.pop_back();
+            cellSprites[newCell].push_back(id);
+            spriteCells[id] = newCell;
+        }
+    }
+
+    /*
+    Draw all sprites visible to the character. Must be called after the walls are drawn and calcRays has filled hits.
+
+    Params:
+        frameBuffer - buffer to draw in.
+        character - camera position, direction, camera plane and per column wall distances.
+        viewLeft, viewTop - frame buffer pixel of the 3D view's top left corner.
+        screenWidth - width of the 3D view in pixels.
+        screenHeight - height of the 3D view in pixels.
+    */
+    void draw(FrameBuffer& frameBuffer, Character& character, int viewLeft, int viewTop, int screenWidth, int screenHeight)
+    {
+        TRACE_ZONE("sprites");
+        auto& hits = character.getHits();
+        int columns = std::min(screenWidth, int(hits.size()));
+        if (columns == 0)
+        {
+            return;
+        }
+
+        //coarse depth buffer: the furthest wall in each tile of columns. A sprite behind every tile it covers is fully occluded.
+        int tileCount = (columns + DEPTH_TILE_WIDTH - 1) / DEPTH_TILE_WIDTH;
+        tileMaxDepth.assign(tileCount, 0.0);
+        double maxDepth = 0.0;
+        for (int i = 0; i < columns; ++i)
+        {
+            tileMaxDepth[i / DEPTH_TILE_WIDTH] = std::max(tileMaxDepth[i / DEPTH_TILE_WIDTH], hits[i].distance);
+            maxDepth = std::max(maxDepth, hits[i].distance);
+        }
+
+        sf::Vector2f center = character.getCenter();
+        sf::Vector2<double> dir = character.getDirectionVector();
+        sf::Vector2<double> plane = character.getCameraPlaneVector();
+        double dirLength = std::sqrt(dir.x * dir.x + dir.y * dir.y);
+
+        //only cells inside the bounding box of the view cone, cut off at the furthest wall, can contain visible sprites.
+        //The angular projections can see all around, so their box is the square around the character.
+        double reach = maxDepth + BLOCK_WIDTH;
+        double coneX[3] = { center.x, center.x + (dir.x - plane.x) / dirLength * reach, center.x + (dir.x + plane.x) / dirLength * reach };
+        double coneY[3] = { center.y, center.y + (dir.y - plane.y) / dirLength * reach, center.y + (dir.y + plane.y) / dirLength * reach };
+        if (character.getProjection() != PROJECTION_FLAT)
+        {
+            coneX[1] = center.x - reach;
+            coneX[2] = center.x + reach;
+            coneY[1] = center.y - reach;
+            coneY[2] = center.y + reach;
+        }
+        int minCellX = std::max(int(std::floor(*std::min_element(coneX, coneX + 3) / BLOCK_WIDTH)), 0);
+        int maxCellX = std::min(int(std::floor(*std::max_element(coneX, coneX + 3) / BLOCK_WIDTH)), WORLD_BLOCK_WIDTH - 1);
+        int minCellY = std::max(int(std::floor(*std::min_element(coneY, coneY + 3) / BLOCK_WIDTH)), 0);
+        int maxCellY = std::min(int(std::floor(*std::max_element(coneY, coneY + 3) / BLOCK_WIDTH)), WORLD_BLOCK_HEIGHT - 1);
+
+        bool useFieldOfView = fieldOfView && fieldOfView->getViewer() == &character;
+        visible.clear();
+        for (int cellY = minCellY; cellY <= maxCellY; ++cellY)
+        {
+            for (int cellX = minCellX; cellX <= maxCellX; ++cellX)
+            {
+                if (useFieldOfView && !fieldOfView->isVisible(cellX, cellY))
+                {
+                    continue;
+                }
+                for (int id : cellSprites[cellY * WORLD_BLOCK_WIDTH + cellX])
+                {
+                    //same projection as calcRays
+                    double screenX, depth;
+                    if (!character.projectPoint(sprites[id].x, sprites[id].y, screenWidth, screenX, depth) || depth < 1.0)
+                    {
+                        continue;
+                    }
+                    double size = screenHeight * BLOCK_WIDTH / depth;
+                    int left = std::max(int(std::floor(screenX - size / 2)), 0);
+                    int right = std::min(int(std::ceil(screenX + size / 2)), columns);
+                    if (left >= right)
+                    {
+                        continue;
+                    }
+
+                    //hits store distances the same way as depth
+                    bool occluded = true;
+                    for (int tile = left / DEPTH_TILE_WIDTH; tile <= (right - 1) / DEPTH_TILE_WIDTH && occluded; ++tile)
+                    {
+                        occluded = tileMaxDepth[tile] <= depth;
+                    }
+                    if (!occluded)
+                    {
+                        visible.push_back(VisibleSprite{ id, depth, screenX, size });
+                    }
+                }
+            }
+        }
+
+        std::sort(visible.begin(), visible.end(), [](const VisibleSprite& a, const VisibleSprite& b) { return a.distance > b.distance; });
+
+        //clip each sprite per column and draw each run of neighbouring visible columns
+        for (const auto& sprite : visible)
+        {
+            int left = std::max(int(std::floor(sprite.screenX - sprite.size / 2)), 0);
+            int right = std::min(int(std::ceil(sprite.screenX + sprite.size / 2)), columns);
+            int runStart = -1;
+            for (int i = left; i <= right; ++i)
+            {
+                bool inFront = i < right && hits[i].distance > sprite.distance;
+                if (inFront && runStart < 0)
+                {
+                    runStart = i;
+                }
+                else if (!inFront && runStart >= 0)
+                {
+                    drawColumns(frameBuffer, sprite, runStart, i, viewLeft, viewTop, screenHeight);
+                    runStart = -1;
+                }
+            }
+        }
+    }
+
+    /*
+    Skip sprites in cells a character cannot see when drawing its view.
+
+    Params:
+        visibleCells - visible set of the character, applied only to the character its last update was for. nullptr to stop culling.
+    */
+    void setFieldOfView(const FieldOfView* visibleCells)
+    {
+        fieldOfView = visibleCells;
+    }
+
+    /*
+    Returns:
+        Number of sprites that passed culling in the last draw.
+    */
+    int getVisibleCount() const
+    {
+        return int(visible.size());
+    }
+
+    auto& getSprites()
+    {
+        return sprites;
+    }
+};
@@ -0,0 +1,219 @@
+#pragma once
+
+//Trace zones are compiled in unless NDEBUG is defined. Define RAYCASTING_TRACE to keep them in a release build.
+#if !defined(RAYCASTING_TRACE) && !defined(NDEBUG)
+#define RAYCASTING_TRACE
+#endif
+
+#if defined(RAYCASTING_TRACE)
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+Records timed zones from every thread and writes them as Chrome trace event JSON, which Perfetto and chrome://tracing open.
+
+Each thread records into its own ring of EVENTS_PER_THREAD events with one writer, the thread, and one reader, flush,
+so recording takes no lock: the writer publishes an event by advancing its written count and flush frees the
+slots it has copied out by advancing its read count. Zones recorded while a ring is full are dropped and counted.
+The only lock is taken when a thread records its first zone or names itself, and by flush.
+
+Use the TRACE_ macros rather than the class, they compile to nothing when tracing is off.
+*/
+class TraceProfiler
+{
+
+public:
+
+    static constexpr std::uint64_t EVENTS_PER_THREAD = 1 << 16;
+
+private:
+
+    struct traceEvent
+    {
+        //zone names are string literals, so only the pointer is stored
+        const char* name;
+        std::uint64_t start;
+        std::uint64_t duration;
+    };
+
+    struct threadBuffer
+    {
+        int threadId;
+        //set under the mutex, read by flush
+        std::string name;
+        std::vector<traceEvent> events;
+        std::atomic<std::uint64_t> written{ 0 };
+        std::atomic<std::uint64_t> read{ 0 };
+        std::atomic<std::uint64_t> dropped{ 0 };
+    };
+
+    std::mutex mutex;
+    //never shrinks, so a thread's buffer outlives the thread and its events can still be flushed
+    std::vector<std::unique_ptr<threadBuffer>> buffers;
+    const std::chrono::steady_clock::time_point epoch{ std::chrono::steady_clock::now() };
+
+    TraceProfiler() = default;
+
+    threadBuffer& localBuffer()
+    {
+        thread_local threadBuffer* buffer = nullptr;
+        if (!buffer)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            buffers.emplace_back(new threadBuffer());
+            buffer = buffers.back().get();
+            buffer->threadId = int(buffers.size());
+            buffer->name = "thread " + std::to_string(buffer->threadId);
+            buffer->events.resize(EVENTS_PER_THREAD);
+        }
+        return *buffer;
+    }
+
+public:
+
+    TraceProfiler(const TraceProfiler&) = delete;
+    TraceProfiler& operator=(const TraceProfiler&) = delete;
+
+    static TraceProfiler& instance()
+    {
+        static TraceProfiler profiler;
+        return profiler;
+    }
+
+    /*
+    Returns:
+        Nanoseconds since the profiler was created.
+    */
+    std::uint64_t now() const
+    {
+        return std::uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count());
+    }
+
+    /*
+    Record a zone of the calling thread.
+
+    Params:
+        name - string literal naming the zone, must not need escaping in JSON.
+        start - now() when the zone began.
+        end - now() when the zone ended.
+    */
+    void record(const char* name, std::uint64_t start, std::uint64_t end)
+    {
+        threadBuffer& buffer = localBuffer();
+        std::uint64_t written = buffer.written.load(std::memory_order_relaxed);
+        if (written - buffer.read.load(std::memory_order_acquire) >= EVENTS_PER_THREAD)
+        {
+            buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        buffer.events[written % EVENTS_PER_THREAD] = traceEvent{ name, start, end - start };
+        buffer.written.store(written + 1, std::memory_order_release);
+    }
+
+    /*
+    Name the calling thread in the trace.
+    */
+    void nameThread(const std::string& name)
+    {
+        threadBuffer& buffer = localBuffer();
+        std::lock_guard<std::mutex> lock(mutex);
+        buffer.name = name;
+    }
+
+    /*
+    Write every zone recorded since the last flush to a trace file and free their slots. Threads keep recording meanwhile,
+    zones they finish during the flush go into the next one.
+
+    Params:
+        path - file to write, replaced if it exists.
+    Returns:
+        False if the file could not be opened.
+    */
+    bool flush(const char* path)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::FILE* file = std::fopen(path, "w");
+        if (!file)
+        {
+            return false;
+        }
+
+        std::fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", file);
+        bool first = true;
+        for (const auto& buffer : buffers)
+        {
+            std::fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",\n", buffer->threadId, buffer->name.c_str());
+            first = false;
+
+            std::uint64_t read = buffer->read.load(std::memory_order_relaxed);
+            std::uint64_t written = buffer->written.load(std::memory_order_acquire);
+            for (std::uint64_t i = read; i < written; ++i)
+            {
+                const traceEvent& event = buffer->events[i % EVENTS_PER_THREAD];
+                //timestamps are in microseconds
+                std::fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                    event.name, buffer->threadId, event.start / 1000.0, event.duration / 1000.0);
+            }
+            buffer->read.store(written, std::memory_order_release);
+
+            std::uint64_t dropped = buffer->dropped.exchange(0, std::memory_order_relaxed);
+            if (dropped != 0)
+            {
+                std::fprintf(file, ",\n{\"name\":\"dropped %llu zones\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"ts\":%.3f}",
+                    static_cast<unsigned long long>(dropped), buffer->threadId, now() / 1000.0);
+            }
+        }
+        std::fputs("\n]}\n", file);
+        return std::fclose(file) == 0;
+    }
+};
+
+//Zone timed from its construction to the end of the enclosing scope
+class TraceZone
+{
+
+private:
+
+    const char* name;
+    std::uint64_t start;
+
+public:
+
+    explicit TraceZone(const char* name) :
+        name(name), start(TraceProfiler::instance().now())
+    {
+    }
+
+    ~TraceZone()
+    {
+        TraceProfiler::instance().record(name, start, TraceProfiler::instance().now());
+    }
+
+    TraceZone(const TraceZone&) = delete;
+    TraceZone& operator=(const TraceZone&) = delete;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+//time the rest of the enclosing scope as a zone
+#define TRACE_ZONE(name) TraceZone TRACE_CONCAT(traceZone, __LINE__)(name)
+//name the calling thread in the trace
+#define TRACE_THREAD(name) TraceProfiler::instance().nameThread(name)
+//write the zones recorded since the last flush to a file
+#define TRACE_FLUSH(path) TraceProfiler::instance().flush(path)
+
+#else
+
+#define TRACE_ZONE(name)
+#define TRACE_THREAD(name)
+#define TRACE_FLUSH(path)
+
+#endif
@@ -0,0 +1,554 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "BatchRaycaster.h"
+#include "Character.h"
+#include "MapGenerator.h"
+#include "WallColors.h"
+#include "WorkerPool.h"
+#include "WorldGrid.h"
+
+//What an agent does during one environment step
+enum environmentAction : std::uint8_t
+{
+    ACTION_NONE,
+    ACTION_FORWARD,
+    ACTION_BACKWARD,
+    ACTION_TURN_LEFT,
+    ACTION_TURN_RIGHT,
+    ACTION_STRAFE_LEFT,
+    ACTION_STRAFE_RIGHT,
+    ACTION_COUNT
+};
+
+//Settings shared by every environment of a VectorEnvironment.
+struct EnvironmentConfig
+{
+    //observation columns, cast with the flat camera plane projection like Character
+    int rayCount{ 64 };
+    float fieldOfView{ float(PI / 2) };
+    //rows of the RGB observation, 0 to skip rendering it
+    int imageHeight{ 48 };
+    //half the side of the agent's collision square, in world pixels
+    float agentRadius{ 8.f };
+    //world pixels moved and radians turned per step
+    float moveSpeed{ MOVEMENT_SPEED * 4 };
+    float turnSpeed{ 0.1f };
+    //steps before an environment is done and respawns
+    int episodeLength{ 500 };
+    std::uint32_t seed{ 1 };
+};
+
+/*
+Many copies of the ray casting world stepped together, as a vision environment for reinforcement learning.
+
+Agent state is stored as structure of arrays, one entry per environment. The maps of all environments are stacked into
+a single WorldGrid, one below the other with a row of GRID_SENTINEL between them, so every ray of every environment is cast
+by one BatchRaycaster against one contiguous block of cells, and a ray can never leave its own map.
+
+step() is a single pass over the worker pool: each chunk of environments applies its actions, casts its rays and writes
+its observations while the agent state is still in cache. All buffers are sized in the constructor, so stepping allocates nothing.
+
+Observations per environment:
+    depth - rayCount floats, distance to the wall from the camera plane in world pixels, like Character hits.
+    material - rayCount ints, cell value of the wall hit, 0 if none.
+    rgb - imageHeight * rayCount * 3 bytes, row major, walls colored like the 3D view over a flat floor and ceiling.
+Rays stop at the first wall of any material, so windows and grates are opaque here.
+*/
+class VectorEnvironment
+{
+
+private:
+
+    static constexpr int ENVIRONMENTS_PER_CHUNK = 8;
+    static constexpr std::uint8_t CEILING_SHADE = 60;
+    static constexpr std::uint8_t FLOOR_SHADE = 100;
+
+    EnvironmentConfig config;
+    int environmentCount;
+    int mapWidth;
+    int mapHeight;
+    WorldGrid grid;
+    BatchRaycaster raycaster;
+
+    //agent state, one entry per environment. Positions are world pixels within the environment's own map.
+    std::vector<float> positionX;
+    std::vector<float> positionY;
+    std::vector<float> heading;
+    std::vector<int> episodeStep;
+    std::vector<std::uint32_t> randomState;
+
+    //flat projection as angles relative to the heading, the same for every environment
+    std::vector<float> offsetCos;
+    std::vector<float> offsetSin;
+
+    //per ray scratch in cell units of the stacked grid, one run of rayCount per environment
+    std::vector<float> rayOriginX;
+    std::vector<float> rayOriginY;
+    std::vector<float> rayDirX;
+    std::vector<float> rayDirY;
+    std::vector<std::uint8_t> rayFace;
+    //half the wall height in image rows and the wall color of each ray, for the RGB observation
+    std::vector<float> wallHalfHeight;
+    std::vector<std::uint8_t> wallColor;
+
+    //observations of the last step or reset
+    std::vector<float> depth;
+    std::vector<int> material;
+    std::vector<std::uint8_t> rgb;
+    std::vector<std::uint8_t> done;
+
+    //map being loaded by loadMap, cropped or padded to the map size
+    std::vector<int> mapRows;
+
+    //actions of the step being run, read by the worker jobs
+    const std::uint8_t* pendingActions{ nullptr };
+
+    /*
+    Stack the maps into one grid. Maps smaller than the largest one are padded with the sentinel.
+    */
+    static std::vector<std::vector<int>> stackMaps(const std::vector<std::vector<std::vector<int>>>& maps, int count, int width, int height)
+    {
+        std::vector<std::vector<int>> stacked;
+        stacked.reserve(size_t(count) * (height + 1));
+        for (int e = 0; e < count; ++e)
+        {
+            const auto& map = maps[maps.size() == 1 ? 0 : e];
+            for (int y = 0; y < height; ++y)
+            {
+                std::vector<int> row(width, GRID_SENTINEL);
+                if (y < int(map.size()))
+                {
+                    std::copy(map[y].begin(), map[y].begin() + std::min(int(map[y].size()), width), row.begin());
+                }
+                stacked.push_back(std::move(row));
+            }
+            stacked.emplace_back(width, GRID_SENTINEL);
+        }
+        return stacked;
+    }
+
+    /*
+    Get the widest row of any map.
+    */
+    static int measureWidth(const std::vector<std::vector<std::vector<int>>>& maps)
+    {
+        int width = 0;
+        for (const auto& map : maps)
+        {
+            for (const auto& row : map)
+            {
+                width = std::max(width, int(row.size()));
+            }
+        }
+        return width;
+    }
+
+    /*
+    Get the tallest map.
+    */
+    static int measureHeight(const std::vector<std::vector<std::vector<int>>>& maps)
+    {
+        int height = 0;
+        for (const auto& map : maps)
+        {
+            height = std::max(height, int(map.size()));
+        }
+        return height;
+    }
+
+    /*
+    Returns:
+        Next value of an environment's xorshift generator.
+    */
+    std::uint32_t nextRandom(int environment)
+    {
+        std::uint32_t& state = randomState[environment];
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    /*
+    Check if an agent's collision square at a position overlaps a wall of its environment's map.
+    */
+    bool collides(int environment, float x, float y) const
+    {
+        int rowOffset = environment * (mapHeight + 1);
+        int left = int(std::floor((x - config.agentRadius) / float(BLOCK_WIDTH)));
+        int right = int(std::floor((x + config.agentRadius) / float(BLOCK_WIDTH)));
+        int top = int(std::floor((y - config.agentRadius) / float(BLOCK_WIDTH)));
+        int bottom = int(std::floor((y + config.agentRadius) / float(BLOCK_WIDTH)));
+        if (left < 0 || top < 0 || right >= mapWidth || bottom >= mapHeight)
+        {
+            return true;
+        }
+        for (int cellY = top; cellY <= bottom; ++cellY)
+        {
+            for (int cellX = left; cellX <= right; ++cellX)
+            {
+                if (grid.isSolid(cellX, rowOffset + cellY))
+                {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    /*
+    Start a new episode: random empty cell and heading. Cells are drawn at random until an empty one turns up,
+    with a scan for the first empty cell if the map is nearly solid.
+    */
+    void respawn(int environment)
+    {
+        static constexpr int SPAWN_TRIES = 64;
+        int rowOffset = environment * (mapHeight + 1);
+        int cell = -1;
+        for (int attempt = 0; attempt < SPAWN_TRIES && cell < 0; ++attempt)
+        {
+            int candidate = int(nextRandom(environment) % std::uint32_t(mapWidth * mapHeight));
+            cell = grid.isSolid(candidate % mapWidth, rowOffset + candidate / mapWidth) ? -1 : candidate;
+        }
+        for (int candidate = 0; candidate < mapWidth * mapHeight && cell < 0; ++candidate)
+        {
+            cell = grid.isSolid(candidate % mapWidth, rowOffset + candidate / mapWidth) ? -1 : candidate;
+        }
+        cell = std::max(cell, 0);
+        positionX[environment] = float((cell % mapWidth + 0.5) * BLOCK_WIDTH);
+        positionY[environment] = float((cell / mapWidth + 0.5) * BLOCK_WIDTH);
+        heading[environment] = float(nextRandom(environment) % 65536 * (2 * PI / 65536));
+        episodeStep[environment] = 0;
+    }
+
+    /*
+    Apply an action, sliding along walls one axis at a time.
+    */
+    void applyAction(int environment, std::uint8_t action)
+    {
+        float forward = 0.f;
+        float left = 0.f;
+        switch (action)
+        {
+        case ACTION_FORWARD:
+            forward = config.moveSpeed;
+            break;
+        case ACTION_BACKWARD:
+            forward = -config.moveSpeed;
+            break;
+        case ACTION_TURN_LEFT:
+            heading[environment] -= config.turnSpeed;
+            break;
+        case ACTION_TURN_RIGHT:
+            heading[environment] += config.turnSpeed;
+            break;
+        case ACTION_STRAFE_LEFT:
+            left = config.moveSpeed;
+            break;
+        case ACTION_STRAFE_RIGHT:
+            left = -config.moveSpeed;
+            break;
+        }
+        if (forward == 0.f && left == 0.f)
+        {
+            return;
+        }
+
+        //left is along the camera plane (headingY, -headingX), the way ACTION_TURN_LEFT turns
+        float headingX = std::cos(heading[environment]);
+        float headingY = std::sin(heading[environment]);
+        float x = positionX[environment];
+        float y = positionY[environment];
+        float moveX = headingX * forward + headingY * left;
+        float moveY = headingY * forward - headingX * left;
+        if (!collides(environment, x + moveX, y))
+        {
+            x += moveX;
+        }
+        if (!collides(environment, x, y + moveY))
+        {
+            y += moveY;
+        }
+        positionX[environment] = x;
+        positionY[environment] = y;
+    }
+
+    /*
+    Cast the rays of a run of environments and write their observations.
+    */
+    void observe(int begin, int end)
+    {
+        const int rays = config.rayCount;
+        for (int e = begin; e < end; ++e)
+        {
+            float headingX = std::cos(heading[e]);
+            float headingY = std::sin(heading[e]);
+            float originX = positionX[e] / float(BLOCK_WIDTH);
+            float originY = positionY[e] / float(BLOCK_WIDTH) + float(e * (mapHeight + 1));
+            size_t first = size_t(e) * rays;
+            for (int column = 0; column < rays; ++column)
+            {
+                rayOriginX[first + column] = originX;
+                rayOriginY[first + column] = originY;
+                rayDirX[first + column] = headingX * offsetCos[column] - headingY * offsetSin[column];
+                rayDirY[first + column] = headingY * offsetCos[column] + headingX * offsetSin[column];
+            }
+        }
+
+        size_t first = size_t(begin) * config.rayCount;
+        int count = (end - begin) * config.rayCount;
+        raycaster.castRays(&rayOriginX[first], &rayOriginY[first], &rayDirX[first], &rayDirY[first], count, &depth[first], &material[first], &rayFace[first]);
+
+        //the kernel measures along the unit ray, the camera plane distance is that times the cosine of the ray's angle
+        for (int e = begin; e < end; ++e)
+        {
+            for (int column = 0; column < rays; ++column)
+            {
+                depth[size_t(e) * rays + column] *= offsetCos[column];
+            }
+            if (config.imageHeight > 0)
+            {
+                render(e);
+            }
+        }
+    }
+
+    /*
+    Draw an environment's RGB observation from its depth and material observations, row by row.
+    */
+    void render(int environment)
+    {
+        const int rays = config.rayCount;
+        const int height = config.imageHeight;
+        const float* columnDepth = &depth[size_t(environment) * rays];
+        const int* columnMaterial = &material[size_t(environment) * rays];
+        const std::uint8_t* columnFace = &rayFace[size_t(environment) * rays];
+        float* halfHeight = &wallHalfHeight[size_t(environment) * rays];
+        std::uint8_t* color = &wallColor[size_t(environment) * rays * 3];
+        std::uint8_t* image = &rgb[size_t(environment) * height * rays * 3];
+
+        //same wall height as the 3D view: screenHeight * BLOCK_WIDTH / distance, centered on the horizon
+        for (int column = 0; column < rays; ++column)
+        {
+            bool wall = columnMaterial[column] > 0 && columnDepth[column] > 0.f;
+            halfHeight[column] = wall ? height * 0.5f * float(BLOCK_WIDTH) / columnDepth[column] : 0.f;
+            sf::Color shade = getWallColor(columnMaterial[column], columnFace[column] == FACE_VERTICAL);
+            color[column * 3] = shade.r;
+            color[column * 3 + 1] = shade.g;
+            color[column * 3 + 2] = shade.b;
+        }
+
+        for (int y = 0; y < height; ++y)
+        {
+            std::uint8_t* pixel = image + size_t(y) * rays * 3;
+            std::uint8_t background = y < height / 2 ? CEILING_SHADE : FLOOR_SHADE;
+            float fromHorizon = std::abs(y + 0.5f - height * 0.5f);
+            for (int column = 0; column < rays; ++column, pixel += 3)
+            {
+                bool wall = fromHorizon < halfHeight[column];
+                pixel[0] = wall ? color[column * 3] : background;
+                pixel[1] = wall ? color[column * 3 + 1] : background;
+                pixel[2] = wall ? color[column * 3 + 2] : background;
+            }
+        }
+    }
+
+public:
+
+    /*
+    Params:
+        maps - map of each environment in the same format as readWorldFile, or a single map shared by all of them.
+        environmentCount - number of environments stepped together.
+        config - settings shared by every environment.
+    */
+    VectorEnvironment(const std::vector<std::vector<std::vector<int>>>& maps, int environmentCount, const EnvironmentConfig& config) :
+        config(config), environmentCount(environmentCount),
+        mapWidth(measureWidth(maps)), mapHeight(measureHeight(maps)),
+        grid(stackMaps(maps, environmentCount, mapWidth, mapHeight)), raycaster(grid)
+    {
+        positionX.assign(environmentCount, 0.f);
+        positionY.assign(environmentCount, 0.f);
+        heading.assign(environmentCount, 0.f);
+        episodeStep.assign(environmentCount, 0);
+        done.assign(environmentCount, 0);
+        randomState.resize(environmentCount);
+        for (int e = 0; e < environmentCount; ++e)
+        {
+            //xorshift needs a non zero state
+            randomState[e] = (config.seed + std::uint32_t(e)) * 2654435761u | 1u;
+        }
+
+        //column c looks through cameraX = 2 * (c + 0.5) / rayCount - 1 of a camera plane tan(fov / 2) long, like BatchRaycaster
+        offsetCos.resize(config.rayCount);
+        offsetSin.resize(config.rayCount);
+        double planeLength = std::tan(config.fieldOfView * 0.5);
+        for (int column = 0; column < config.rayCount; ++column)
+        {
+            double cameraX = 2.0 * (column + 0.5) / config.rayCount - 1.0;
+            double angle = -std::atan(cameraX * planeLength);
+            offsetCos[column] = float(std::cos(angle));
+            offsetSin[column] = float(std::sin(angle));
+        }
+
+        size_t totalRays = size_t(environmentCount) * config.rayCount;
+        rayOriginX.resize(totalRays);
+        rayOriginY.resize(totalRays);
+        rayDirX.resize(totalRays);
+        rayDirY.resize(totalRays);
+        rayFace.resize(totalRays);
+        depth.resize(totalRays);
+        material.resize(totalRays);
+        wallHalfHeight.resize(totalRays);
+        wallColor.resize(totalRays * 3);
+        rgb.resize(totalRays * std::max(config.imageHeight, 0) * 3);
+    }
+
+    /*
+    Respawn every agent and observe the first frame of its episode.
+
+    Params:
+        pool - workers the environments are split across.
+    */
+    void reset(WorkerPool& pool)
+    {
+        for (int e = 0; e < environmentCount; ++e)
+        {
+            respawn(e);
+            done[e] = 0;
+        }
+        //only captures this, so std::function keeps the job inline and nothing is allocated
+        pool.parallelFor(environmentCount, ENVIRONMENTS_PER_CHUNK, [this](int begin, int end)
+        {
+            observe(begin, end);
+        });
+    }
+
+    /*
+    Advance every environment by one step and observe the result. An environment that reaches the episode length
+    is marked done and respawned, and its observation is the first frame of its next episode.
+
+    Params:
+        actions - one environmentAction per environment.
+        pool - workers the environments are split across.
+    */
+    void step(const std::uint8_t* actions, WorkerPool& pool)
+    {
+        pendingActions = actions;
+        pool.parallelFor(environmentCount, ENVIRONMENTS_PER_CHUNK, [this](int begin, int end)
+        {
+            for (int e = begin; e < end; ++e)
+            {
+                applyAction(e, pendingActions[e]);
+                done[e] = ++episodeStep[e] >= config.episodeLength;
+                if (done[e])
+                {
+                    respawn(e);
+                }
+            }
+            observe(begin, end);
+        });
+        pendingActions = nullptr;
+    }
+
+    /*
+    Replace an environment's map between steps, e.g. with a MapGenerator level when its episode is done.
+    The agent respawns on the new map and starts a new episode; its observation is updated by the next step or reset.
+
+    Params:
+        environment - environment index.
+        map - new map, cropped or padded with the sentinel to the size of the maps given to the constructor.
+    */
+    void loadMap(int environment, const GeneratedMap& map)
+    {
+        mapRows.resize(size_t(mapWidth) * mapHeight);
+        for (int y = 0; y < mapHeight; ++y)
+        {
+            int* row = &mapRows[size_t(y) * mapWidth];
+            int copied = y < map.height ? std::min(map.width, mapWidth) : 0;
+            std::copy(map.cells.begin() + size_t(y) * map.width, map.cells.begin() + size_t(y) * map.width + copied, row);
+            std::fill(row + copied, row + mapWidth, GRID_SENTINEL);
+        }
+        grid.setRows(environment * (mapHeight + 1), mapHeight, mapRows.data());
+        respawn(environment);
+    }
+
+    /*
+    Put an agent at a given pose, e.g. for scripted evaluation. Takes effect in the next observation.
+
+    Params:
+        environment - environment index.
+        x, y - position in world pixels within the environment's map.
+        angle - heading in radians.
+    */
+    void place(int environment, float x, float y, float angle)
+    {
+        positionX[environment] = x;
+        positionY[environment] = y;
+        heading[environment] = angle;
+    }
+
+    int getEnvironmentCount() const
+    {
+        return environmentCount;
+    }
+
+    const EnvironmentConfig& getConfig() const
+    {
+        return config;
+    }
+
+    /*
+    Returns:
+        rayCount depths per environment, environment after environment.
+    */
+    const float* getDepth() const
+    {
+        return depth.data();
+    }
+
+    /*
+    Returns:
+        rayCount materials per environment, environment after environment.
+    */
+    const int* getMaterial() const
+    {
+        return material.data();
+    }
+
+    /*
+    Returns:
+        imageHeight * rayCount * 3 bytes per environment, environment after environment.
+    */
+    const std::uint8_t* getRgb() const
+    {
+        return rgb.data();
+    }
+
+    /*
+    Returns:
+        1 for each environment whose episode ended in the last step.
+    */
+    const std::uint8_t* getDone() const
+    {
+        return done.data();
+    }
+
+    const float* getPositionX() const
+    {
+        return positionX.data();
+    }
+
+    const float* getPositionY() const
+    {
+        return positionY.data();
+    }
+
+    const float* getHeading() const
+    {
+        return heading.data();
+    }
+};
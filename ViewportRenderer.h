@@ -0,0 +1,324 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <SFML/Graphics/RenderWindow.hpp>
+#include <SFML/Graphics/View.hpp>
+#include "Character.h"
+#include "FloorCaster.h"
+#include "FrameBuffer.h"
+#include "MirrorReflections.h"
+#include "TraceProfiler.h"
+#include "SharedFrameRing.h"
+#include "SpriteRenderer.h"
+#include "WallColors.h"
+#include "WorkerPool.h"
+#include "WorldGrid.h"
+
+//Camera drawn into a rectangle of the 3D view. Coordinates are frame buffer pixels.
+struct Viewport
+{
+    Character* camera;
+    int left;
+    int top;
+    int width;
+    int height;
+};
+
+/*
+Renders one or more cameras into the 3D window, e.g. split screen for local multiplayer or several agents side by side.
+
+Each stage runs once for all viewports instead of once per camera. The floor rows of every viewport are one batch on the
+worker pool. Then the columns of every viewport are cut into jobs that cast their rays and draw their walls into the frame buffer,
+and those jobs are another batch. Sprites and transparent walls are then composited into the frame buffer viewport by viewport, and the frame buffer is
+uploaded once, so the published frame holds everything the window shows.
+The viewports share the frame buffer, so four viewports fill the same number of pixels as a single full size view.
+*/
+class ViewportRenderer
+{
+
+private:
+
+    //columns cast and filled by one job. Cameras using FACE_SPANS are one job each, that engine sweeps the whole view.
+    static constexpr int COLUMNS_PER_JOB = 64;
+    static constexpr int ROWS_PER_CHUNK = 16;
+
+    const WorldGrid& grid;
+    FloorCaster& floorCaster;
+    SpriteRenderer& spriteRenderer;
+    MirrorReflections& reflections;
+
+    std::vector<Viewport> viewports;
+    int frameWidth{ 1 };
+    int frameHeight{ 1 };
+
+    //per frame scratch, kept to avoid reallocating
+    struct columnJob
+    {
+        int viewport;
+        int first;
+        //inclusive
+        int last;
+    };
+    std::vector<columnJob> columnJobs;
+    std::vector<FloorCaster::floorView> floorViews;
+    //index of the first floor row of each viewport in the row batch, plus the total at the end
+    std::vector<int> rowOffsets;
+    std::vector<Character*> mirrorCameras;
+
+    //where the column hits of every viewport are copied, see setColumnSink. Viewport v starts at columnOffsets[v].
+    SharedColumnHit* columnSink{ nullptr };
+    int columnCapacity{ 0 };
+    std::vector<int> columnOffsets;
+
+    /*
+    Draw one column of a wall into the frame buffer, blending if the color is translucent.
+
+    Params:
+        frameBuffer - buffer to draw in.
+        viewport - region the column belongs to.
+        column - column within the viewport.
+        inverseDistance - 1 / distance to the wall from the camera plane.
+        color - wall color.
+    */
+    static void fillWallColumn(FrameBuffer& frameBuffer, const Viewport& viewport, int column, double inverseDistance, sf::Color color)
+    {
+        //same projection as the floor: height on screen = screenHeight * BLOCK_WIDTH / distance, centered on the horizon
+        double lineHeight = inverseDistance * viewport.height * BLOCK_WIDTH;
+        double top = viewport.height / 2 - lineHeight / 2;
+        int first = std::max(int(std::ceil(top - 0.5)), 0);
+        int last = std::min(int(std::ceil(top + lineHeight - 0.5)), viewport.height);
+
+        std::uint32_t packed = packColor(color.r, color.g, color.b);
+        for (int y = first; y < last; ++y)
+        {
+            std::uint32_t& pixel = frameBuffer.row(viewport.top + y)[viewport.left + column];
+            if (color.a == 255)
+            {
+                pixel = packed;
+                continue;
+            }
+            auto blend = [&](int shift)
+            {
+                std::uint32_t below = (pixel >> shift) & 0xff;
+                std::uint32_t above = (packed >> shift) & 0xff;
+                return ((above * color.a + below * (255 - color.a)) / 255) << shift;
+            };
+            pixel = blend(0) | blend(8) | blend(16) | (std::uint32_t(255) << 24);
+        }
+    }
+
+    /*
+    Cast and draw the walls of one column job.
+    */
+    void runColumnJob(FrameBuffer& frameBuffer, const columnJob& job)
+    {
+        const Viewport& viewport = viewports[job.viewport];
+        Character& camera = *viewport.camera;
+        auto& hits = camera.getHits();
+        if (camera.sweepsFaceSpans())
+        {
+            camera.calcRays(hits, viewport.width, grid);
+        }
+        else
+        {
+            camera.castColumnRange(hits, job.first, job.last, viewport.width, grid);
+        }
+
+        //column viewport.width is only cast as the right edge of the camera plane, it is not on screen
+        for (int i = job.first; i <= std::min(job.last, viewport.width - 1); ++i)
+        {
+            //rays that hit nothing within the maximum ray distance leave the floor and ceiling showing
+            if (hits[i].color != 0)
+            {
+                fillWallColumn(frameBuffer, viewport, i, hits[i].inverseDistance, getWallColor(hits[i].color, hits[i].alignment == hits[i].vertical));
+            }
+            int sinkIndex = columnOffsets[job.viewport] + i;
+            if (sinkIndex < columnCapacity)
+            {
+                columnSink[sinkIndex] = SharedColumnHit{ float(hits[i].distance), hits[i].color, std::uint8_t(hits[i].alignment == hits[i].vertical),
+                    std::uint8_t(hits[i].layerCount), std::uint8_t(job.viewport), 0 };
+            }
+        }
+    }
+
+public:
+
+    /*
+    Params:
+        grid - map the cameras cast through.
+        floorCaster - floor and ceiling materials and textures.
+        spriteRenderer - sprites drawn over the walls.
+        reflections - what mirror walls reflect.
+    */
+    ViewportRenderer(const WorldGrid& grid, FloorCaster& floorCaster, SpriteRenderer& spriteRenderer, MirrorReflections& reflections) :
+        grid(grid), floorCaster(floorCaster), spriteRenderer(spriteRenderer), reflections(reflections)
+    {
+    }
+
+    /*
+    Split a frame into one viewport per camera. One camera fills the frame, two are side by side,
+    three or four are laid out two per row.
+
+    Params:
+        cameras - cameras to render, must stay valid until the next layout call.
+        width - frame width in pixels, at most the frame buffer width.
+        height - frame height in pixels, at most the frame buffer height.
+    */
+    void layout(const std::vector<Character*>& cameras, int width, int height)
+    {
+        frameWidth = width;
+        frameHeight = height;
+        viewports.clear();
+
+        int count = int(cameras.size());
+        int perRow = count > 2 ? 2 : std::max(count, 1);
+        int rows = (count + perRow - 1) / perRow;
+        for (int i = 0; i < count; ++i)
+        {
+            int row = i / perRow;
+            int inRow = std::min(perRow, count - row * perRow);
+            int slot = i % perRow;
+
+            //the last viewport of each row and column takes the rounding remainder
+            Viewport viewport;
+            viewport.camera = cameras[i];
+            viewport.left = slot * (width / inRow);
+            viewport.top = row * (height / rows);
+            viewport.width = slot == inRow - 1 ? width - viewport.left : width / inRow;
+            viewport.height = row == rows - 1 ? height - viewport.top : height / rows;
+            viewports.push_back(viewport);
+        }
+    }
+
+    /*
+    Render every viewport of the last layout call into the window.
+
+    Params:
+        window - window to draw in.
+        frameBuffer - buffer the whole 3D view is drawn in.
+        pool - workers the rows and columns are split across.
+    */
+    void render(sf::RenderWindow& window, FrameBuffer& frameBuffer, WorkerPool& pool)
+    {
+        TRACE_ZONE("render");
+        frameBuffer.setWidth(frameWidth);
+
+        //floor and ceiling rows of every viewport in one batch
+        floorViews.clear();
+        rowOffsets.assign(1, 0);
+        for (const auto& viewport : viewports)
+        {
+            floorViews.push_back(floorCaster.prepareView(*viewport.camera, viewport.left, viewport.top, viewport.width, viewport.height));
+            rowOffsets.push_back(rowOffsets.back() + FloorCaster::countRows(floorViews.back()));
+        }
+        pool.parallelFor(rowOffsets.back(), ROWS_PER_CHUNK, [&](int begin, int end)
+        {
+            int view = int(std::upper_bound(rowOffsets.begin(), rowOffsets.end(), begin) - rowOffsets.begin()) - 1;
+            for (int row = begin; row < end; ++row)
+            {
+                while (row >= rowOffsets[view + 1])
+                {
+                    ++view;
+                }
+                floorCaster.castRow(frameBuffer, floorViews[view], row - rowOffsets[view]);
+            }
+        });
+
+        //ray casting and wall drawing for every column of every viewport in one batch
+        columnJobs.clear();
+        columnOffsets.assign(1, 0);
+        for (int v = 0; v < int(viewports.size()); ++v)
+        {
+            columnOffsets.push_back(columnOffsets.back() + viewports[v].width);
+            Character& camera = *viewports[v].camera;
+            int columns = viewports[v].width;
+            camera.beginColumns(camera.getHits(), columns);
+            int jobColumns = camera.sweepsFaceSpans() ? columns + 1 : COLUMNS_PER_JOB;
+            for (int first = 0; first <= columns; first += jobColumns)
+            {
+                columnJobs.push_back(columnJob{ v, first, std::min(first + jobColumns - 1, columns) });
+            }
+        }
+        pool.parallelFor(int(columnJobs.size()), 1, [&](int begin, int end)
+        {
+            for (int job = begin; job < end; ++job)
+            {
+                runColumnJob(frameBuffer, columnJobs[job]);
+            }
+        });
+
+        //mirrors, whose secondary rays are batched over every camera by MirrorReflections
+        mirrorCameras.clear();
+        for (const auto& viewport : viewports)
+        {
+            mirrorCameras.push_back(viewport.camera);
+        }
+        reflections.update(mirrorCameras, pool);
+        for (int v = 0; v < int(viewports.size()); ++v)
+        {
+            const Viewport& viewport = viewports[v];
+            const auto& reflected = reflections.getReflections(v);
+            for (int i = 0; i < viewport.width; ++i)
+            {
+                //the reflected wall is further away than the mirror, so it always fits inside the mirror's column
+                if (reflected[i].color != 0)
+                {
+                    fillWallColumn(frameBuffer, viewport, i, reflected[i].inverseDistance, getWallColor(reflected[i].color, reflected[i].alignment == reflected[i].vertical));
+                }
+            }
+        }
+
+        for (const auto& viewport : viewports)
+        {
+            //sprites are clipped against the wall distances, so draw them before the transparent walls that may be in front of them
+            Character& camera = *viewport.camera;
+            spriteRenderer.draw(frameBuffer, camera, viewport.left, viewport.top, viewport.width, viewport.height);
+
+            //transparent walls are blended over whatever is behind them, furthest first
+            auto& hits = camera.getHits();
+            for (int i = 0; i < viewport.width; ++i)
+            {
+                for (int layer = hits[i].layerCount - 1; layer >= 0; --layer)
+                {
+                    const auto& hit = camera.getLayers()[i][layer];
+                    fillWallColumn(frameBuffer, viewport, i, hit.inverseDistance, getWallColor(hit.color, hit.alignment == hit.vertical));
+                }
+            }
+        }
+
+        //draw in frame buffer pixels, the view stretches them to the window size.
+        window.setView(sf::View(sf::FloatRect(0.f, 0.f, float(frameWidth), float(frameHeight))));
+        frameBuffer.draw(window);
+    }
+
+    /*
+    Copy the hit of every on screen column into an array while casting, e.g. a SharedFrameRing slot.
+    Columns of later viewports follow those of earlier ones. Columns past the capacity are dropped.
+
+    Params:
+        columns - array to write to, or nullptr to stop copying.
+        capacity - number of entries in columns.
+    */
+    void setColumnSink(SharedColumnHit* columns, int capacity)
+    {
+        columnSink = columns;
+        columnCapacity = columns ? capacity : 0;
+    }
+
+    /*
+    Returns:
+        Number of column hits the last render wrote to the column sink.
+    */
+    int getColumnCount() const
+    {
+        return std::min(columnOffsets.empty() ? 0 : columnOffsets.back(), columnCapacity);
+    }
+
+    const std::vector<Viewport>& getViewports() const
+    {
+        return viewports;
+    }
+};
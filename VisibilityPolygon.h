@@ -0,0 +1,226 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <SFML/Graphics/RenderWindow.hpp>
+#include <SFML/Graphics/VertexArray.hpp>
+#include "Character.h"
+#include "WorldGrid.h"
+
+/*
+Exact region of the 2D map the character can see, as a triangle fan around the character center.
+
+The outline of the visible region can only change direction at wall corners or at the edges of the field of view, so
+instead of one ray per screen column the polygon casts rays at those angles only: the two field of view edges and,
+for every wall corner inside the field of view, one ray straight at it and one just either side to find what lies behind it.
+Corners are collected once per map. The polygon is cached and only rebuilt when the character moves or turns.
+*/
+class VisibilityPolygon
+{
+
+private:
+
+    //angle between the two rays cast either side of a corner
+    static constexpr double CORNER_EPSILON = 1e-5;
+
+    const WorldGrid& grid;
+
+    //grid vertices where walls change direction, in world coordinates
+    std::vector<sf::Vector2f> corners;
+
+    //polygon outline sorted by angle relative to the character direction
+    struct OutlinePoint
+    {
+        double angle;
+        sf::Vector2f position;
+    };
+    std::vector<OutlinePoint> outline;
+    sf::VertexArray fan{ sf::TriangleFan };
+
+    //pose the polygon was built for
+    sf::Vector2f builtCenter{ -1.f, -1.f };
+    sf::Vector2<double> builtDirection;
+
+    /*
+    Collect grid vertices that are wall corners: one, three or two diagonally opposite of the four cells around them block sight.
+    Transparent walls are seen through, as in the 3D view, so they make no corners.
+    */
+    void findCorners()
+    {
+        for (int y = 0; y <= grid.getHeight(); ++y)
+        {
+            for (int x = 0; x <= grid.getWidth(); ++x)
+            {
+                bool topLeft = grid.blocksSight(x - 1, y - 1);
+                bool topRight = grid.blocksSight(x, y - 1);
+                bool bottomLeft = grid.blocksSight(x - 1, y);
+                bool bottomRight = grid.blocksSight(x, y);
+                int solid = topLeft + topRight + bottomLeft + bottomRight;
+                bool diagonal = solid == 2 && topLeft == bottomRight;
+                if (solid == 1 || solid == 3 || diagonal)
+                {
+                    corners.push_back(sf::Vector2f(float(x * BLOCK_WIDTH), float(y * BLOCK_WIDTH)));
+                }
+            }
+        }
+    }
+
+    /*
+    Cast a ray from the center through the grid and return where it first enters a cell that blocks sight.
+
+    Params:
+        center - ray origin in world coordinates.
+        rayDirX, rayDirY - ray direction, any length.
+    */
+    sf::Vector2f castRay(sf::Vector2f center, double rayDirX, double rayDirY) const
+    {
+        int mapX = CellIndexing<BLOCK_PIXELS>::cell(int(center.x));
+        int mapY = CellIndexing<BLOCK_PIXELS>::cell(int(center.y));
+        double deltaDistX = (rayDirX == 0) ? 1e30 : std::abs(BLOCK_WIDTH / rayDirX);
+        double deltaDistY = (rayDirY == 0) ? 1e30 : std::abs(BLOCK_WIDTH / rayDirY);
+        int stepX = rayDirX < 0 ? -1 : 1;
+        int stepY = rayDirY < 0 ? -1 : 1;
+        double sideDistX = (rayDirX == 0) ? 1e30 : rayDirX < 0 ? (center.x - mapX * BLOCK_WIDTH) / -rayDirX : ((mapX + 1) * BLOCK_WIDTH - center.x) / rayDirX;
+        double sideDistY = (rayDirY == 0) ? 1e30 : rayDirY < 0 ? (center.y - mapY * BLOCK_WIDTH) / -rayDirY : ((mapY + 1) * BLOCK_WIDTH - center.y) / rayDirY;
+
+        double rayLengths = 0.0;
+        int maxSteps = grid.getWidth() + grid.getHeight() + 2;
+        for (int step = 0; step < maxSteps; ++step)
+        {
+            if (sideDistX < sideDistY)
+            {
+                rayLengths = sideDistX;
+                sideDistX += deltaDistX;
+                mapX += stepX;
+            }
+            else
+            {
+                rayLengths = sideDistY;
+                sideDistY += deltaDistY;
+                mapY += stepY;
+            }
+            if (grid.blocksSight(mapX, mapY))
+            {
+                break;
+            }
+        }
+        return sf::Vector2f(float(center.x + rayDirX * rayLengths), float(center.y + rayDirY * rayLengths));
+    }
+
+    /*
+    Cast a ray at an angle relative to the character direction and add the hit to the outline.
+    */
+    void addOutlinePoint(sf::Vector2f center, double headingAngle, double angle)
+    {
+        sf::Vector2f hit = castRay(center, std::cos(headingAngle + angle), std::sin(headingAngle + angle));
+        outline.push_back(OutlinePoint{ angle, hit });
+    }
+
+public:
+
+    /*
+    Params:
+        grid - map the polygon is computed against. Must outlive the polygon.
+    */
+    explicit VisibilityPolygon(const WorldGrid& grid) :
+        grid(grid)
+    {
+        findCorners();
+    }
+
+    /*
+    Rebuild the polygon if the character moved or turned since it was last built.
+
+    Params:
+        character - camera position, direction and camera plane.
+    */
+    void update(Character& character)
+    {
+        sf::Vector2f center = character.getCenter();
+        sf::Vector2<double> dir = character.getDirectionVector();
+        if (center.x == builtCenter.x && center.y == builtCenter.y && dir.x == builtDirection.x && dir.y == builtDirection.y)
+        {
+            return;
+        }
+        builtCenter = center;
+        builtDirection = dir;
+
+        sf::Vector2<double> plane = character.getCameraPlaneVector();
+        double headingAngle = std::atan2(dir.y, dir.x);
+        double halfFieldOfView = std::atan2(std::sqrt(plane.x * plane.x + plane.y * plane.y), std::sqrt(dir.x * dir.x + dir.y * dir.y));
+
+        outline.clear();
+        addOutlinePoint(center, headingAngle, -halfFieldOfView);
+        addOutlinePoint(center, headingAngle, halfFieldOfView);
+        for (const auto& corner : corners)
+        {
+            double relativeX = corner.x - center.x;
+            double relativeY = corner.y - center.y;
+            //angle of the corner relative to the character direction
+            double angle = std::atan2(dir.x * relativeY - dir.y * relativeX, dir.x * relativeX + dir.y * relativeY);
+            if (std::abs(angle) >= halfFieldOfView || (relativeX == 0 && relativeY == 0))
+            {
+                continue;
+            }
+            addOutlinePoint(center, headingAngle, std::max(angle - CORNER_EPSILON, -halfFieldOfView));
+            addOutlinePoint(center, headingAngle, angle);
+            addOutlinePoint(center, headingAngle, std::min(angle + CORNER_EPSILON, halfFieldOfView));
+        }
+        std::sort(outline.begin(), outline.end(), [](const OutlinePoint& a, const OutlinePoint& b) { return a.angle < b.angle; });
+
+        fan.clear();
+        fan.append(sf::Vertex(center, sf::Color(255, 255, 255, 70)));
+        for (const auto& point : outline)
+        {
+            fan.append(sf::Vertex(point.position, sf::Color(255, 255, 255, 70)));
+        }
+    }
+
+    /*
+    Check if a world position is inside the visible region.
+
+    Params:
+        x - world X coordinate.
+        y - world Y coordinate.
+    Returns:
+        True if the character can see the point.
+    */
+    bool isVisible(float x, float y) const
+    {
+        if (outline.size() < 2)
+        {
+            return false;
+        }
+        double relativeX = x - builtCenter.x;
+        double relativeY = y - builtCenter.y;
+        double angle = std::atan2(builtDirection.x * relativeY - builtDirection.y * relativeX, builtDirection.x * relativeX + builtDirection.y * relativeY);
+        if (angle < outline.front().angle || angle > outline.back().angle)
+        {
+            return false;
+        }
+
+        //edge of the outline between the two points either side of the angle
+        auto next = std::upper_bound(outline.begin(), outline.end(), angle, [](double value, const OutlinePoint& point) { return value < point.angle; });
+        if (next == outline.end())
+        {
+            --next;
+        }
+        auto previous = next == outline.begin() ? next : next - 1;
+        double edgeX = next->position.x - previous->position.x;
+        double edgeY = next->position.y - previous->position.y;
+
+        //the point is visible if it is on the same side of the edge as the center
+        double pointSide = edgeX * (y - previous->position.y) - edgeY * (x - previous->position.x);
+        double centerSide = edgeX * (builtCenter.y - previous->position.y) - edgeY * (builtCenter.x - previous->position.x);
+        return pointSide * centerSide >= 0;
+    }
+
+    /*
+    Draw the visible region as a translucent triangle fan.
+    */
+    void draw(sf::RenderWindow& window)
+    {
+        window.draw(fan);
+    }
+};
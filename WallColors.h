@@ -0,0 +1,31 @@
+#pragma once
+
+#include <SFML/Graphics/Color.hpp>
+
+/*
+Get the color a wall material is drawn with in the 3D view.
+
+Params:
+    material - cell value of the wall.
+    vertical - true for faces crossing an X grid line. Horizontal faces are shaded darker to contrast with them.
+*/
+inline sf::Color getWallColor(int material, bool vertical)
+{
+    int colorAdjustment = vertical ? 0 : -25;
+    switch (material)
+    {
+    case 1:
+        return sf::Color(175 + colorAdjustment, 0, 0);
+    case 2:
+        return sf::Color(0, 175 + colorAdjustment, 0);
+    case 3:
+        return sf::Color(0, 0, 175 + colorAdjustment);
+    case 4:
+        return sf::Color(140 + colorAdjustment, 200 + colorAdjustment, 230, 70); //window
+    case 5:
+        return sf::Color(110 + colorAdjustment, 110 + colorAdjustment, 110 + colorAdjustment, 150); //grate
+    case 6:
+        return sf::Color(150 + colorAdjustment, 160 + colorAdjustment, 170 + colorAdjustment); //mirror
+    }
+    return sf::Color(0, 0, 0);
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "TraceProfiler.h"
+
+/*
+Fixed set of worker threads that split an index range into chunks and process them in parallel.
+The calling thread takes part in the work, so a pool created on a single core machine simply runs jobs inline.
+Jobs must not call parallelFor on the same pool.
+*/
+class WorkerPool
+{
+
+private:
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    //current job and how it is split into chunks
+    std::function<void(int, int)> job;
+    std::atomic<int> nextChunk{ 0 };
+    int jobSize{ 0 };
+    int chunkSize{ 1 };
+    int chunkCount{ 0 };
+
+    //number of workers still busy with the current job
+    int activeWorkers{ 0 };
+    //incremented for every job so sleeping workers know there is new work
+    unsigned generation{ 0 };
+    bool stopping{ false };
+
+    /*
+    Claim chunks of the current job until none are left.
+    */
+    void runChunks()
+    {
+        TRACE_ZONE("parallelFor");
+        int chunk;
+        while ((chunk = nextChunk.fetch_add(1)) < chunkCount)
+        {
+            int begin = chunk * chunkSize;
+            int end = std::min(begin + chunkSize, jobSize);
+            job(begin, end);
+        }
+    }
+
+    //index only names the thread in traces, which release builds leave out
+    void workerLoop([[maybe_unused]] unsigned index)
+    {
+        TRACE_THREAD("worker " + std::to_string(index));
+        unsigned seenGeneration = 0;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return stopping || generation != seenGeneration; });
+                if (stopping)
+                {
+                    return;
+                }
+                seenGeneration = generation;
+            }
+
+            runChunks();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--activeWorkers == 0)
+            {
+                done.notify_one();
+            }
+        }
+    }
+
+public:
+
+    /*
+    Params:
+        threadCount - total threads working on a job, including the calling thread.
+    */
+    explicit WorkerPool(unsigned threadCount = std::thread::hardware_concurrency())
+    {
+        for (unsigned i = 1; i < threadCount; ++i)
+        {
+            workers.emplace_back(&WorkerPool::workerLoop, this, i);
+        }
+    }
+
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    /*
+    Run fn over [0, count) split into chunks of grain indices. Returns once every chunk is processed.
+
+    Params:
+        count - number of indices to process.
+        grain - number of indices handed to a thread at a time.
+        fn - called with the [begin, end) range of each chunk, never more than grain indices long.
+    */
+    void parallelFor(int count, int grain, const std::function<void(int, int)>& fn)
+    {
+        grain = std::max(grain, 1);
+        if (workers.empty() || count <= grain)
+        {
+            for (int begin = 0; begin < count; begin += grain)
+            {
+                fn(begin, std::min(begin + grain, count));
+            }
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = fn;
+            jobSize = count;
+            chunkSize = grain;
+            chunkCount = (count + grain - 1) / grain;
+            nextChunk = 0;
+            activeWorkers = int(workers.size());
+            ++generation;
+        }
+        wake.notify_all();
+
+        runChunks();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&] { return activeWorkers == 0; });
+    }
+
+    /*
+    Returns:
+        Number of threads that work on a job, including the calling thread.
+    */
+    int getThreadCount() const
+    {
+        return int(workers.size()) + 1;
+    }
+};
@@ -0,0 +1,463 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+//value of the border cells around the grid. Non zero so ray loops stop on it, negative so it is never mistaken for a wall.
+static constexpr int GRID_SENTINEL = -1;
+
+//material flags, indexed by cell value. Transparent walls (windows, grates) are drawn but rays carry on behind them.
+//Mirrors are opaque walls that show what a reflected ray hits, see MirrorReflections.
+static constexpr int MATERIAL_TRANSPARENT = 1 << 0;
+static constexpr int MATERIAL_MIRROR = 1 << 1;
+static constexpr int MATERIAL_COUNT = 7;
+static constexpr int MATERIAL_FLAGS[MATERIAL_COUNT] = { 0, 0, 0, 0, MATERIAL_TRANSPARENT, MATERIAL_TRANSPARENT, MATERIAL_MIRROR };
+
+/*
+Check if a cell value is a transparent material. Empty cells, the sentinel and unknown values are not.
+*/
+inline bool isTransparentMaterial(int material)
+{
+    return material > 0 && material < MATERIAL_COUNT && (MATERIAL_FLAGS[material] & MATERIAL_TRANSPARENT);
+}
+
+/*
+Check if a cell value is a mirror material.
+*/
+inline bool isMirrorMaterial(int material)
+{
+    return material > 0 && material < MATERIAL_COUNT && (MATERIAL_FLAGS[material] & MATERIAL_MIRROR);
+}
+
+//Cells, occupancy words and clearance of a band of WorldGrid::PAGE_ROWS rows, as saved by a snapshot. Never modified once saved.
+struct GridPage
+{
+    std::vector<int> cells;
+    std::vector<std::uint64_t> occupancy;
+    std::vector<std::uint8_t> clearance;
+};
+
+//Saved contents of a WorldGrid. Pages that did not change between snapshots are shared rather than copied.
+struct GridSnapshot
+{
+    int width{ 0 };
+    int height{ 0 };
+    std::vector<std::shared_ptr<const GridPage>> pages;
+};
+
+/*
+World map stored as one flat row major vector of cells. Same values as the 2D worldMap read from csv:
+0 is empty space and anything else is a wall of that color/material.
+
+The cells are surrounded by a one cell border of GRID_SENTINEL. A ray stepping one cell at a time from inside the grid
+always lands on the border before it could leave the storage, so stepping loops only need to test the cell value
+and no bounds.
+
+Alongside the cells the grid keeps two acceleration structures for queries that only care whether a cell is solid:
+an occupancy bitset with one bit per cell, and a clearance field holding the Chebyshev distance from each cell to the nearest
+solid cell. Everything outside the grid counts as solid.
+
+Cells can be changed with setCell, which keeps both structures up to date. The grid can be saved and restored with snapshot
+and restore for rewinding or branching a simulation. Rows are grouped in pages: a snapshot only copies the pages changed
+since the last one and shares the rest, and a restore only copies back the pages that differ from the current contents.
+*/
+class WorldGrid
+{
+
+public:
+
+    //rows per snapshot page
+    static constexpr int PAGE_ROWS = 16;
+
+private:
+
+    int width;
+    int height;
+    //row stride of the padded cells, width + 2
+    int stride;
+    //cells including the sentinel border, row by row
+    std::vector<int> cells;
+
+    //one bit per cell, each row padded to whole 64 bit words
+    int wordsPerRow;
+    std::vector<std::uint64_t> occupancy;
+
+    //0 for solid cells, otherwise every cell closer than this (Chebyshev distance) is empty. Capped at MAX_CLEARANCE.
+    static constexpr int MAX_CLEARANCE = 255;
+    std::vector<std::uint8_t> clearance;
+
+    //Page each band of rows was last saved to or restored from, nullptr if changed since.
+    //Pages are compared by pointer, so an unchanged band is never copied twice.
+    std::vector<std::shared_ptr<const GridPage>> pageSources;
+    //clearance of the rows setCell recomputes, used to find the pages it changed
+    std::vector<std::uint8_t> previousClearance;
+
+    /*
+    Build occupancy bits and clearance field from the cells.
+    */
+    void buildAccelerators()
+    {
+        wordsPerRow = (width + 63) / 64;
+        occupancy.assign(size_t(wordsPerRow) * height, 0);
+        clearance.assign(size_t(width) * height, 0);
+
+        for (int y = 0; y < height; ++y)
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                if (at(x, y) != 0)
+                {
+                    occupancy[size_t(y) * wordsPerRow + (x >> 6)] |= std::uint64_t(1) << (x & 63);
+                }
+            }
+        }
+        buildClearance(0, height - 1);
+    }
+
+    /*
+    Recompute the clearance of a band of rows with a two pass chamfer over the 8 neighbours, which is exact for Chebyshev distance.
+    Rows outside the band are read as they are, so they must already be correct.
+
+    Params:
+        firstRow - first row of the band.
+        lastRow - last row of the band, inclusive.
+    */
+    void buildClearance(int firstRow, int lastRow)
+    {
+        for (int y = firstRow; y <= lastRow; ++y)
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                int toOutside = std::min(std::min(x + 1, y + 1), std::min(width - x, height - y));
+                clearance[size_t(y) * width + x] = at(x, y) != 0 ? 0 : std::uint8_t(std::min(toOutside, MAX_CLEARANCE));
+            }
+        }
+
+        auto relax = [&](int x, int y, int neighbourX, int neighbourY)
+        {
+            if (contains(neighbourX, neighbourY))
+            {
+                std::uint8_t& value = clearance[size_t(y) * width + x];
+                value = std::uint8_t(std::min<int>(value, getClearance(neighbourX, neighbourY) + 1));
+            }
+        };
+        for (int y = firstRow; y <= lastRow; ++y)
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                relax(x, y, x - 1, y);
+                relax(x, y, x - 1, y - 1);
+                relax(x, y, x, y - 1);
+                relax(x, y, x + 1, y - 1);
+            }
+        }
+        for (int y = lastRow; y >= firstRow; --y)
+        {
+            for (int x = width - 1; x >= 0; --x)
+            {
+                relax(x, y, x + 1, y);
+                relax(x, y, x + 1, y + 1);
+                relax(x, y, x, y + 1);
+                relax(x, y, x - 1, y + 1);
+            }
+        }
+    }
+
+    /*
+    Check if every cell of a row is solid. Clearance never depends on cells on the far side of such a row.
+    */
+    bool isSolidRow(int y) const
+    {
+        const std::uint64_t* words = &occupancy[size_t(y) * wordsPerRow];
+        for (int word = 0; word < wordsPerRow; ++word)
+        {
+            int bits = std::min(width - word * 64, 64);
+            std::uint64_t full = bits == 64 ? ~std::uint64_t(0) : (std::uint64_t(1) << bits) - 1;
+            if (words[word] != full)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /*
+    Recompute the clearance that rows of changed cells can affect and forget the saved pages whose clearance changed.
+
+    Params:
+        changedFirst - first row with changed cells.
+        changedLast - last row with changed cells, inclusive.
+    */
+    void refreshClearance(int changedFirst, int changedLast)
+    {
+        //clearance is capped, so cells more than MAX_CLEARANCE rows away cannot depend on the changed cells, and neither can cells past a solid row
+        int firstRow = changedFirst;
+        while (firstRow > 0 && changedFirst - firstRow < MAX_CLEARANCE && !isSolidRow(firstRow - 1))
+        {
+            --firstRow;
+        }
+        int lastRow = changedLast;
+        while (lastRow < height - 1 && lastRow - changedLast < MAX_CLEARANCE && !isSolidRow(lastRow + 1))
+        {
+            ++lastRow;
+        }
+
+        previousClearance.assign(clearance.begin() + size_t(firstRow) * width, clearance.begin() + size_t(lastRow + 1) * width);
+        buildClearance(firstRow, lastRow);
+        for (int row = firstRow; row <= lastRow; ++row)
+        {
+            if (pageSources[row / PAGE_ROWS] &&
+                !std::equal(clearance.begin() + size_t(row) * width, clearance.begin() + size_t(row + 1) * width, previousClearance.begin() + size_t(row - firstRow) * width))
+            {
+                pageSources[row / PAGE_ROWS] = nullptr;
+            }
+        }
+    }
+
+    int pageCount() const
+    {
+        return (height + PAGE_ROWS - 1) / PAGE_ROWS;
+    }
+
+public:
+
+    /*
+    Params:
+        worldMap - 2D vector describing the world map, as returned by readWorldFile.
+    */
+    explicit WorldGrid(const std::vector<std::vector<int>>& worldMap) :
+        width(worldMap.empty() ? 0 : int(worldMap[0].size())), height(int(worldMap.size())), stride(width + 2)
+    {
+        cells.assign(size_t(stride) * (height + 2), GRID_SENTINEL);
+        for (int y = 0; y < height; ++y)
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                cells[paddedIndex(x, y)] = x < int(worldMap[y].size()) ? worldMap[y][x] : 0;
+            }
+        }
+        buildAccelerators();
+    }
+
+    /*
+    Params:
+        width - cells per row.
+        height - number of rows.
+        flatCells - width * height cell values row by row, e.g. from MapGenerator.
+    */
+    WorldGrid(int width, int height, const std::vector<int>& flatCells) :
+        width(width), height(height), stride(width + 2)
+    {
+        cells.assign(size_t(stride) * (height + 2), GRID_SENTINEL);
+        for (int y = 0; y < height; ++y)
+        {
+            std::copy(flatCells.begin() + size_t(y) * width, flatCells.begin() + size_t(y + 1) * width, cells.begin() + paddedIndex(0, y));
+        }
+        buildAccelerators();
+    }
+
+    /*
+    Get cell value. Coordinates must be inside the grid.
+
+    Params:
+        x - cell column.
+        y - cell row.
+    */
+    int at(int x, int y) const
+    {
+        return cells[paddedIndex(x, y)];
+    }
+
+    /*
+    Get index of a cell in paddedData(). Valid for -1 to width and -1 to height, which includes the border.
+
+    Params:
+        x - cell column.
+        y - cell row.
+    */
+    int paddedIndex(int x, int y) const
+    {
+        return (y + 1) * stride + (x + 1);
+    }
+
+    /*
+    Check if cell coordinates are inside the grid.
+    */
+    bool contains(int x, int y) const
+    {
+        return x >= 0 && y >= 0 && x < width && y < height;
+    }
+
+    /*
+    Check if a cell is a wall using the occupancy bits. Cells outside the grid are solid.
+
+    Params:
+        x - cell column.
+        y - cell row.
+    */
+    bool isSolid(int x, int y) const
+    {
+        if (!contains(x, y))
+        {
+            return true;
+        }
+        return (occupancy[size_t(y) * wordsPerRow + (x >> 6)] >> (x & 63)) & 1;
+    }
+
+    /*
+    Check if a cell hides what is behind it: a wall that is not a transparent material. Cells outside the grid block sight.
+
+    Params:
+        x - cell column.
+        y - cell row.
+    */
+    bool blocksSight(int x, int y) const
+    {
+        return isSolid(x, y) && (!contains(x, y) || !isTransparentMaterial(at(x, y)));
+    }
+
+    /*
+    Get Chebyshev distance from a cell to the nearest solid cell. Coordinates must be inside the grid.
+
+    Params:
+        x - cell column.
+        y - cell row.
+    */
+    int getClearance(int x, int y) const
+    {
+        return clearance[size_t(y) * width + x];
+    }
+
+    /*
+    Change a cell and update the occupancy bits and clearance field around it. Coordinates must be inside the grid.
+
+    Params:
+        x - cell column.
+        y - cell row.
+        value - new cell value, 0 for empty.
+    */
+    void setCell(int x, int y, int value)
+    {
+        if (at(x, y) == value)
+        {
+            return;
+        }
+        cells[paddedIndex(x, y)] = value;
+        std::uint64_t bit = std::uint64_t(1) << (x & 63);
+        std::uint64_t& word = occupancy[size_t(y) * wordsPerRow + (x >> 6)];
+        word = value != 0 ? word | bit : word & ~bit;
+        pageSources.resize(pageCount());
+        pageSources[y / PAGE_ROWS] = nullptr;
+        refreshClearance(y, y);
+    }
+
+    /*
+    Replace whole rows of cells, e.g. with a generated map, and update the occupancy bits and clearance field around them.
+
+    Params:
+        firstRow - first row replaced.
+        rowCount - number of rows replaced, they must be inside the grid.
+        rowCells - getWidth() * rowCount cell values row by row.
+    */
+    void setRows(int firstRow, int rowCount, const int* rowCells)
+    {
+        pageSources.resize(pageCount());
+        for (int y = firstRow; y < firstRow + rowCount; ++y)
+        {
+            const int* source = rowCells + size_t(y - firstRow) * width;
+            std::copy(source, source + width, cells.begin() + paddedIndex(0, y));
+            std::uint64_t* words = &occupancy[size_t(y) * wordsPerRow];
+            std::fill(words, words + wordsPerRow, std::uint64_t(0));
+            for (int x = 0; x < width; ++x)
+            {
+                words[x >> 6] |= std::uint64_t(source[x] != 0) << (x & 63);
+            }
+            pageSources[y / PAGE_ROWS] = nullptr;
+        }
+        refreshClearance(firstRow, firstRow + rowCount - 1);
+    }
+
+    /*
+    Save the grid. Pages unchanged since the last snapshot or restore are shared with it instead of copied.
+
+    Params:
+        snapshot - set to the grid's contents. Its storage is reused, so saving into the same snapshot again does not allocate
+            for unchanged pages.
+    */
+    void snapshot(GridSnapshot& snapshot)
+    {
+        pageSources.resize(pageCount());
+        for (int page = 0; page < pageCount(); ++page)
+        {
+            if (pageSources[page])
+            {
+                continue;
+            }
+            int first = page * PAGE_ROWS;
+            int last = std::min(first + PAGE_ROWS, height);
+            auto saved = std::make_shared<GridPage>();
+            saved->cells.assign(cells.begin() + size_t(first + 1) * stride, cells.begin() + size_t(last + 1) * stride);
+            saved->occupancy.assign(occupancy.begin() + size_t(first) * wordsPerRow, occupancy.begin() + size_t(last) * wordsPerRow);
+            saved->clearance.assign(clearance.begin() + size_t(first) * width, clearance.begin() + size_t(last) * width);
+            pageSources[page] = std::move(saved);
+        }
+        snapshot.width = width;
+        snapshot.height = height;
+        snapshot.pages.assign(pageSources.begin(), pageSources.end());
+    }
+
+    /*
+    Restore a snapshot of this grid, or of one with the same size. Only pages that differ from the current contents are copied.
+
+    Returns:
+        False if the snapshot is of a grid with another size, in which case nothing changes.
+    */
+    bool restore(const GridSnapshot& snapshot)
+    {
+        if (snapshot.width != width || snapshot.height != height || int(snapshot.pages.size()) != pageCount())
+        {
+            return false;
+        }
+        pageSources.resize(pageCount());
+        for (int page = 0; page < pageCount(); ++page)
+        {
+            const auto& saved = snapshot.pages[page];
+            if (pageSources[page] == saved)
+            {
+                continue;
+            }
+            int first = page * PAGE_ROWS;
+            std::copy(saved->cells.begin(), saved->cells.end(), cells.begin() + size_t(first + 1) * stride);
+            std::copy(saved->occupancy.begin(), saved->occupancy.end(), occupancy.begin() + size_t(first) * wordsPerRow);
+            std::copy(saved->clearance.begin(), saved->clearance.end(), clearance.begin() + size_t(first) * width);
+            pageSources[page] = saved;
+        }
+        return true;
+    }
+
+    /*
+    Returns:
+        Cells including the sentinel border, see paddedIndex. Moving one cell in Y moves getStride() entries.
+    */
+    const int* paddedData() const
+    {
+        return cells.data();
+    }
+
+    int getStride() const
+    {
+        return stride;
+    }
+
+    int getWidth() const
+    {
+        return width;
+    }
+
+    int getHeight() const
+    {
+        return height;
+    }
+};